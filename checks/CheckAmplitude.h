@@ -0,0 +1,41 @@
+#ifndef CHECKAMPLITUDE
+#define CHECKAMPLITUDE
+
+#include <cmath>
+
+#include "Clas12PhotonsAmplitude.h"
+
+/* Simple amplitude used by the check programs: a W Breit-Wigner times an exponential t slope,
+ with a different phase for the two photon helicities.*/
+class CheckAmplitude: public Clas12PhotonsAmplitude<CheckAmplitude> {
+
+public:
+
+	CheckAmplitude() :
+			Clas12PhotonsAmplitude<CheckAmplitude>() {
+	}
+	CheckAmplitude(const vector<string>& args) :
+			Clas12PhotonsAmplitude<CheckAmplitude>(args) {
+	}
+
+	string name() const {
+		return "CheckAmplitude";
+	}
+
+	complex<GDouble> calcHelicityAmplitude(int helicity, GDouble** pKin) const {
+		GDouble P[4], W2, t;
+		const GDouble M = 1.3, G = 0.2;
+
+		for (int i = 0; i < 4; i++)
+			P[i] = pKin[0][i] - pKin[1][i] + pKin[2][i]; //W, E px py pz
+		W2 = P[0] * P[0] - P[1] * P[1] - P[2] * P[2] - P[3] * P[3];
+		for (int i = 0; i < 4; i++)
+			P[i] = pKin[2][i] - pKin[3][i]; //target - recoil
+		t = -(P[0] * P[0] - P[1] * P[1] - P[2] * P[2] - P[3] * P[3]);
+
+		complex<GDouble> bw = complex<GDouble>(M * G, 0) / complex<GDouble>(M * M - W2, -M * G);
+		return bw * exp(-1.5 * t) * ((helicity == 1) ? complex<GDouble>(1, 0) : complex<GDouble>(0.3, 0.6));
+	}
+};
+
+#endif
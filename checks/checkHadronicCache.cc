@@ -0,0 +1,178 @@
+/* Check of the hadronic amplitudes shared by the instances of the same wave in calcAmplitudeAll: over several passes, with a parameter
+ that changes between them and new events loaded in the same data block, the amplitudes of each instance have to be the ones of the
+ direct evaluation. A mirrored pair (+1,+1) (-1,-1) shares them, three instances of the same wave do not.
+ Usage: checkHadronicCache [nEvents]. Returns 1 if an amplitude differs or the pair does not share.*/
+
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include <atomic>
+
+#include "CheckAmplitude.h"
+#include "Clas12PhotonsPSEventGenerator.h"
+
+#include "IUAmpTools/ConfigurationInfo.h"
+
+using namespace std;
+
+static const int nPasses = 6;
+
+static const CheckAmplitude shape;
+
+//CheckAmplitude times a scale, that plays the role of a free parameter. Counts the hadronic evaluations
+class ScaledAmplitude: public Clas12PhotonsAmplitude<ScaledAmplitude> {
+
+public:
+
+	ScaledAmplitude() :
+			Clas12PhotonsAmplitude<ScaledAmplitude>() {
+	}
+	ScaledAmplitude(const vector<string>& args) :
+			Clas12PhotonsAmplitude<ScaledAmplitude>(args) {
+	}
+
+	string name() const {
+		return "ScaledAmplitude";
+	}
+
+	complex<GDouble> calcHelicityAmplitude(int helicity, GDouble** pKin) const {
+		nCalls++;
+		return scale * shape.calcHelicityAmplitude(helicity, pKin);
+	}
+
+	static double scale;
+	static std::atomic<long> nCalls;
+};
+
+double ScaledAmplitude::scale = 1;
+std::atomic<long> ScaledAmplitude::nCalls(0);
+
+static void fillBlock(Clas12PhotonsPSEventGenerator &gen, int N, vector<GDouble> &data) {
+	vector<vector<TLorentzVector> > block(N);
+	gen.GenerateBlock(block);
+	int Np = block[0].size();
+	data.resize(4 * N * Np);
+	for (int iev = 0; iev < N; iev++) {
+		for (int ip = 0; ip < Np; ip++) {
+			GDouble *P = &(data[4 * (iev * Np + ip)]);
+			P[0] = block[iev][ip].E();
+			P[1] = block[iev][ip].Px();
+			P[2] = block[iev][ip].Py();
+			P[3] = block[iev][ip].Pz();
+		}
+	}
+}
+
+//the instances are evaluated in the given order, as AmpTools does. Returns false if an amplitude differs from the direct one.
+//nShared is the number of hadronic evaluations saved, from the second pass on
+static bool checkWave(const string &title, const vector<Amplitude*> &amps, Clas12PhotonsPSEventGenerator &gen, int N, long &nShared) {
+	const ScaledAmplitude *first = dynamic_cast<const ScaledAmplitude*>(amps[0]);
+	unsigned int numVars = first->numUserVars();
+	int Np;
+	vector<GDouble> data, userVars, out(2 * N);
+	vector<vector<int> > permutations(1);
+	vector<GDouble*> pKin;
+	double maxDiff = 0;
+	long nCalls = 0;
+
+	nShared = 0;
+	for (int ipass = 0; ipass < nPasses; ipass++) {
+		ScaledAmplitude::scale = 1 + ipass;
+		//a new block every other pass, in the same buffer
+		if (ipass % 2 == 0) {
+			fillBlock(gen, N, data);
+			Np = data.size() / (4 * N);
+			permutations[0].resize(Np);
+			for (int ip = 0; ip < Np; ip++)
+				permutations[0][ip] = ip;
+			pKin.resize(Np);
+			userVars.resize((size_t) N * numVars);
+			for (int iev = 0; iev < N; iev++) {
+				for (int ip = 0; ip < Np; ip++)
+					pKin[ip] = &(data[4 * (iev * Np + ip)]);
+				first->calcUserVars(&(pKin[0]), &(userVars[(size_t) iev * numVars]));
+			}
+		}
+
+		ScaledAmplitude::nCalls = 0;
+		for (unsigned int iamp = 0; iamp < amps.size(); iamp++) {
+			amps[iamp]->calcAmplitudeAll(&(data[0]), &(out[0]), N, &permutations, &(userVars[0]));
+			for (int iev = 0; iev < N; iev++) {
+				for (int ip = 0; ip < Np; ip++)
+					pKin[ip] = &(data[4 * (iev * Np + ip)]);
+				long nBefore = ScaledAmplitude::nCalls;
+				complex<GDouble> ref = amps[iamp]->calcAmplitude(&(pKin[0]), &(userVars[(size_t) iev * numVars]));
+				ScaledAmplitude::nCalls = nBefore;
+				double diff = abs(ref - complex<GDouble>(out[2 * iev], out[2 * iev + 1]));
+				maxDiff = max(maxDiff, (abs(ref) > 0) ? diff / abs(ref) : diff);
+			}
+		}
+		if (ipass > 0) {
+			nCalls = ScaledAmplitude::nCalls;
+			for (unsigned int iamp = 0; iamp < amps.size(); iamp++)
+				if (!dynamic_cast<const ScaledAmplitude*>(amps[iamp])->isIdenticallyZero()) nShared += 2 * N;
+			nShared -= nCalls;
+		}
+	}
+
+	printf("%-40s max relative difference %.3g, hadronic evaluations saved %li\n", title.c_str(), maxDiff, nShared);
+	if (!(maxDiff < 1E-12)) {
+		cout << "FAILED: " << title << " uses stale hadronic amplitudes" << endl;
+		return false;
+	}
+	return true;
+}
+
+static vector<Amplitude*> makeWave(const string &wave, const int helicities[][2], int n) {
+	ScaledAmplitude prototype;
+	vector<Amplitude*> amps;
+
+	for (int i = 0; i < n; i++) {
+		vector<string> args;
+		args.push_back(to_string(helicities[i][0]));
+		args.push_back(to_string(helicities[i][1]));
+		args.push_back(wave);
+		amps.push_back(prototype.newAmplitude(args));
+	}
+	return amps;
+}
+
+int main(int argc, char **argv) {
+	int N = (argc > 1) ? atoi(argv[1]) : 5000;
+	const int pair[2][2] = { { 1, 1 }, { -1, -1 } };
+	const int three[4][2] = { { 1, 1 }, { -1, -1 }, { 1, -1 }, { 1, 1 } };
+	long nShared;
+	bool ok = true;
+
+	ReactionInfo reaction;
+	reaction.m_pl.push_back("e-");
+	reaction.m_pl.push_back("e-");
+	reaction.m_pl.push_back("proton");
+	reaction.m_pl.push_back("proton");
+	reaction.m_pl.push_back("pi+");
+	reaction.m_pl.push_back("pi-");
+
+	Clas12PhotonsPSEventGenerator gen;
+	gen.setReaction(&reaction);
+	gen.setSeed(1);
+
+	vector<Amplitude*> amps = makeWave("pair", pair, 2);
+	ok = checkWave("mirrored pair", amps, gen, N, nShared) && ok;
+	if (nShared != (long) (nPasses - 1) * 2 * N) {
+		cout << "FAILED: the mirrored pair does not share its hadronic amplitudes" << endl;
+		ok = false;
+	}
+	for (unsigned int iamp = 0; iamp < amps.size(); iamp++)
+		delete amps[iamp];
+
+	amps = makeWave("three", three, 4);
+	ok = checkWave("three instances and a helicity flip", amps, gen, N, nShared) && ok;
+	for (unsigned int iamp = 0; iamp < amps.size(); iamp++)
+		delete amps[iamp];
+
+	if (!ok) return 1;
+	cout << "OK" << endl;
+	return 0;
+}
@@ -0,0 +1,141 @@
+/* Check of the leptonic current implementations against the scalar Clas12PhotonsAmplitude<T>::calcElectronScattering, that uses
+ the explicit rotations to the helicity frame, on a sample of phase space events: the batch version (calcElectronScatteringBatch)
+ and the rotation-free closed form (Clas12PhotonsLeptonicCurrent::calcEvent, runtime and compile-time helicities)
+ have to give the same JP, J0, JM for the four helicity configurations.
+ Usage: checkLeptonicCurrent [nEvents]. Returns 1 if the largest relative difference is above the tolerance.*/
+
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+
+#include "CheckAmplitude.h"
+#include "Clas12PhotonsPSEventGenerator.h"
+#include "Clas12PhotonsLeptonicCurrent.h"
+
+#include "IUAmpTools/ConfigurationInfo.h"
+
+using namespace std;
+
+static const int helicities[4][2] = { { 1, 1 }, { 1, -1 }, { -1, 1 }, { -1, -1 } };
+
+//the currents are compared relative to |JP|+|JM|, or absolute if they are 0 (helicity flip)
+static double difference(const ElectronScatteringTerm &ref, const complex<GDouble> &JP, const complex<GDouble> &J0, const complex<GDouble> &JM) {
+	double scale = abs(ref.JP) + abs(ref.JM);
+	double diff = abs(ref.JP - JP) + abs(ref.J0 - J0) + abs(ref.JM - JM);
+	return (scale > 0) ? diff / scale : diff;
+}
+
+//returns false if the difference is above the tolerance
+static bool report(const string &title, double maxDiff, double tolerance) {
+	printf("%-40s max relative difference %.3g (tolerance %.1g)\n", title.c_str(), maxDiff, tolerance);
+	if (!(maxDiff <= tolerance)) {
+		cout << "FAILED: " << title << " differs from the rotation path" << endl;
+		return false;
+	}
+	return true;
+}
+
+static bool checkBatch(const vector<GDouble> &data, int N, int Np, double tolerance) {
+	vector<complex<GDouble> > JP(N), J0(N), JM(N);
+	vector<GDouble*> pKin(Np);
+	ElectronScatteringTerm ref;
+	bool ok = true;
+
+	for (int ihel = 0; ihel < 4; ihel++) {
+		vector<string> args;
+		args.push_back(to_string(helicities[ihel][0]));
+		args.push_back(to_string(helicities[ihel][1]));
+		CheckAmplitude amp(args);
+
+		amp.calcElectronScatteringBatch(&(data[0]), N, Np, &(JP[0]), &(J0[0]), &(JM[0]));
+
+		double maxDiff = 0;
+		for (int iev = 0; iev < N; iev++) {
+			for (int ip = 0; ip < Np; ip++)
+				pKin[ip] = const_cast<GDouble*>(&(data[4 * (iev * Np + ip)]));
+			amp.calcElectronScattering(&(pKin[0]), ref);
+			maxDiff = max(maxDiff, difference(ref, JP[iev], J0[iev], JM[iev]));
+		}
+		ok = report("batch (" + args[0] + "," + args[1] + ") " + Clas12PhotonsLeptonicCurrent::instructionSet(), maxDiff, tolerance) && ok;
+	}
+	return ok;
+}
+
+template<int helicityBeam, int helicityElectron> static void calcClosedForm(GDouble** pKin, complex<GDouble> &JP, complex<GDouble> &J0, complex<GDouble> &JM) {
+	Clas12PhotonsLeptonicCurrent::calcEvent<helicityBeam, helicityElectron>(pKin, JP, J0, JM);
+}
+
+static bool checkClosedForm(const vector<GDouble> &data, int N, int Np, double tolerance) {
+	typedef void (*ClosedForm)(GDouble**, complex<GDouble>&, complex<GDouble>&, complex<GDouble>&);
+	const ClosedForm fixed[4] = { calcClosedForm<1, 1>, calcClosedForm<1, -1>, calcClosedForm<-1, 1>, calcClosedForm<-1, -1> };
+	complex<GDouble> JP, J0, JM;
+	vector<GDouble*> pKin(Np);
+	ElectronScatteringTerm ref;
+	bool ok = true;
+
+	for (int ihel = 0; ihel < 4; ihel++) {
+		vector<string> args;
+		args.push_back(to_string(helicities[ihel][0]));
+		args.push_back(to_string(helicities[ihel][1]));
+		CheckAmplitude amp(args);
+
+		double maxDiff = 0, maxDiffFixed = 0;
+		for (int iev = 0; iev < N; iev++) {
+			for (int ip = 0; ip < Np; ip++)
+				pKin[ip] = const_cast<GDouble*>(&(data[4 * (iev * Np + ip)]));
+			amp.calcElectronScattering(&(pKin[0]), ref);
+
+			Clas12PhotonsLeptonicCurrent::calcEvent(&(pKin[0]), helicities[ihel][0], helicities[ihel][1], JP, J0, JM);
+			maxDiff = max(maxDiff, difference(ref, JP, J0, JM));
+
+			fixed[ihel](&(pKin[0]), JP, J0, JM);
+			maxDiffFixed = max(maxDiffFixed, difference(ref, JP, J0, JM));
+		}
+		ok = report("closed form (" + args[0] + "," + args[1] + ")", maxDiff, tolerance) && ok;
+		ok = report("closed form <" + args[0] + "," + args[1] + ">", maxDiffFixed, tolerance) && ok;
+	}
+	return ok;
+}
+
+int main(int argc, char **argv) {
+	int N = (argc > 1) ? atoi(argv[1]) : 100000;
+	//the two paths round differently, the tolerance follows the precision of GDouble
+	double tolerance = (sizeof(GDouble) == sizeof(float)) ? 1E-4 : 1E-9;
+	bool ok = true;
+
+	ReactionInfo reaction;
+	reaction.m_pl.push_back("e-");
+	reaction.m_pl.push_back("e-");
+	reaction.m_pl.push_back("proton");
+	reaction.m_pl.push_back("proton");
+	reaction.m_pl.push_back("pi+");
+	reaction.m_pl.push_back("pi-");
+
+	Clas12PhotonsPSEventGenerator gen;
+	gen.setReaction(&reaction);
+	gen.setSeed(1);
+
+	//the phase space events in the AmpTools layout: E, px, py, pz of each particle
+	vector<vector<TLorentzVector> > block(N);
+	gen.GenerateBlock(block);
+	int Np = block[0].size();
+	vector<GDouble> data(4 * N * Np);
+	for (int iev = 0; iev < N; iev++) {
+		for (int ip = 0; ip < Np; ip++) {
+			GDouble *P = &(data[4 * (iev * Np + ip)]);
+			P[0] = block[iev][ip].E();
+			P[1] = block[iev][ip].Px();
+			P[2] = block[iev][ip].Py();
+			P[3] = block[iev][ip].Pz();
+		}
+	}
+
+	ok = checkBatch(data, N, Np, tolerance) && ok;
+	ok = checkClosedForm(data, N, Np, tolerance) && ok;
+
+	if (!ok) return 1;
+	cout << "OK" << endl;
+	return 0;
+}
@@ -0,0 +1,137 @@
+/* Check of the weighted generation with the t-weight: the t spectrum of the weighted sample, each event with its weight,
+ has to agree with the one of the unweighted sample, both stored and streamed, and with the ones generated with the adaptive proposal
+ on top of the t sampling. All of them represent phase space x t-weight x intensity.
+ Usage: checkTweight [nEvents]. Returns 1 if the chi2 per bin of a difference is above 3.*/
+
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "CheckAmplitude.h"
+#include "Clas12PhotonsAmplitudeEventGenerator.h"
+#include "Clas12PhotonsEventSink.h"
+
+#include "IUAmpTools/AmpToolsInterface.h"
+
+using namespace std;
+
+static const int nBins = 20;
+static const double tMax = 2.; //GeV^2, the last bin has all the events above
+
+static string writeConfig() {
+	string fname = "checkTweight.cfg";
+	ofstream cfg(fname.c_str());
+
+	cfg << "fit checkTweight" << endl;
+	cfg << "reaction R e- e- proton proton pi+ pi-" << endl;
+	cfg << "sum R S" << endl;
+	cfg << "amplitude R::S::pp CheckAmplitude 1 1" << endl;
+	cfg << "amplitude R::S::mm CheckAmplitude -1 -1" << endl;
+	cfg << "initialize R::S::pp cartesian 1.0 0.0 fixed" << endl;
+	cfg << "initialize R::S::mm cartesian 1.0 0.0 fixed" << endl;
+	cfg.close();
+	return fname;
+}
+
+//t spectrum, and its squared errors
+class Spectrum: public Clas12PhotonsEventSink {
+
+public:
+
+	Spectrum() :
+			h(nBins, 0), e2(nBins, 0) {
+	}
+
+	void fill(double t, double w) {
+		int ibin = min(int(t / tMax * nBins), nBins - 1);
+		h[ibin] += w;
+		e2[ibin] += w * w;
+	}
+	bool writeEvent(const vector<TLorentzVector> &event, double weight) {
+		this->fill(-(event[2] - event[3]).M2(), weight);
+		return true;
+	}
+	//normalized to 1
+	void normalize() {
+		double sum = 0;
+		for (int ibin = 0; ibin < nBins; ibin++)
+			sum += h[ibin];
+		for (int ibin = 0; ibin < nBins; ibin++) {
+			h[ibin] /= sum;
+			e2[ibin] /= sum * sum;
+		}
+	}
+
+	vector<double> h, e2;
+};
+
+static void fillSpectrum(Clas12PhotonsAmplitudeEventGenerator &gen, int N, bool weighted, Spectrum &spectrum) {
+	for (int i = 0; i < N; i++) {
+		Clas12PhotonsEventView event = gen.GetEventView(i);
+		spectrum.fill(-(event.Target() - event.Recoil()).M2(), weighted ? gen.GetWeight(i) : 1);
+	}
+	spectrum.normalize();
+}
+
+//returns false if the two spectra differ
+static bool compare(const string &title, const Spectrum &a, const Spectrum &b) {
+	int ndf = 0;
+	double chi2 = 0;
+
+	cout << "t bin   unweighted   " << title << endl;
+	for (int ibin = 0; ibin < nBins; ibin++) {
+		printf("%5.2f   %.5f +- %.5f   %.5f +- %.5f\n", ibin * tMax / nBins, a.h[ibin], sqrt(a.e2[ibin]), b.h[ibin], sqrt(b.e2[ibin]));
+		if (a.e2[ibin] + b.e2[ibin] <= 0) continue;
+		chi2 += pow(a.h[ibin] - b.h[ibin], 2) / (a.e2[ibin] + b.e2[ibin]);
+		ndf++;
+	}
+	printf("chi2 / bins = %.2f / %i\n", chi2, ndf);
+	if (ndf == 0 || chi2 > 3 * ndf) {
+		cout << "FAILED: the unweighted and " << title << " t spectra differ" << endl;
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char **argv) {
+	int N = (argc > 1) ? atoi(argv[1]) : 20000;
+	bool ok = true;
+	Spectrum unweighted, weighted, streamed, proposalUnweighted, proposalWeighted;
+
+	AmpToolsInterface::registerAmplitude(CheckAmplitude());
+	string cfg = writeConfig();
+
+	Clas12PhotonsAmplitudeEventGenerator gen(cfg, N);
+	gen.setSeed(1);
+	gen.EnableTweight();
+
+	gen.GenerateEvents();
+	fillSpectrum(gen, N, false, unweighted);
+
+	gen.setWeighted(true);
+	gen.GenerateEvents();
+	fillSpectrum(gen, N, true, weighted);
+	ok = compare("weighted", unweighted, weighted) && ok;
+
+	gen.GenerateEvents(streamed);
+	streamed.normalize();
+	ok = compare("weighted streaming", unweighted, streamed) && ok;
+
+	//the proposal grid is trained on the events with the sampled t
+	gen.setAdaptiveProposal(3, N, 20);
+	gen.setWeighted(false);
+	gen.GenerateEvents();
+	fillSpectrum(gen, N, false, proposalUnweighted);
+	ok = compare("proposal unweighted", unweighted, proposalUnweighted) && ok;
+
+	gen.setWeighted(true);
+	gen.GenerateEvents();
+	fillSpectrum(gen, N, true, proposalWeighted);
+	ok = compare("proposal weighted", unweighted, proposalWeighted) && ok;
+
+	if (!ok) return 1;
+	cout << "OK" << endl;
+	return 0;
+}
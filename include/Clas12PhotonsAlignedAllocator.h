@@ -0,0 +1,44 @@
+#ifndef CLAS12PHOTONSALIGNEDALLOCATOR
+#define CLAS12PHOTONSALIGNEDALLOCATOR
+
+#include <cstdlib>
+#include <cstddef>
+#include <new>
+
+/* Allocator for vectors whose data has to start on an Alignment-byte boundary (a power of 2, multiple of sizeof(void*)):
+ with 64 the columns start on a cache line and the vectorized loops over them do aligned loads. Only the first element is aligned.*/
+template<class T, size_t Alignment = 64> class Clas12PhotonsAlignedAllocator {
+
+public:
+
+	typedef T value_type;
+
+	template<class U> struct rebind {
+		typedef Clas12PhotonsAlignedAllocator<U, Alignment> other;
+	};
+
+	Clas12PhotonsAlignedAllocator() {
+	}
+	template<class U> Clas12PhotonsAlignedAllocator(const Clas12PhotonsAlignedAllocator<U, Alignment>&) {
+	}
+
+	T* allocate(size_t n) {
+		void *p = 0;
+		if (n == 0) return 0;
+		if (n > size_t(-1) / sizeof(T) || posix_memalign(&p, Alignment, n * sizeof(T)) != 0) throw std::bad_alloc();
+		return static_cast<T*>(p);
+	}
+	void deallocate(T *p, size_t) {
+		free(p);
+	}
+
+};
+
+template<class T, class U, size_t Alignment> bool operator==(const Clas12PhotonsAlignedAllocator<T, Alignment>&, const Clas12PhotonsAlignedAllocator<U, Alignment>&) {
+	return true;
+}
+template<class T, class U, size_t Alignment> bool operator!=(const Clas12PhotonsAlignedAllocator<T, Alignment>&, const Clas12PhotonsAlignedAllocator<U, Alignment>&) {
+	return false;
+}
+
+#endif
@@ -6,18 +6,17 @@
 #include "IUAmpTools/AmpParameter.h"
 #include "GPUManager/GPUCustomTypes.h"
 #include "TLorentzVector.h"
+#include "Clas12PhotonsLeptonicCurrent.h"
 
 #include <utility>
 #include <string>
 #include <complex>
 #include <vector>
-
-#ifdef GPU_ACCELERATION
-
-void GPUConstant_exec( dim3 dimGrid, dim3 dimBlock, GPU_AMP_PROTO,
-		GDouble module, GDouble phase);
-
-#endif // GPU_ACCELERATION
+#include <map>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <thread>
 
 using std::complex;
 using namespace std;
@@ -32,6 +31,32 @@ typedef struct {
 
 } ElectronScatteringTerm;
 
+//hadronic amplitudes of one event and permutation, shared by the instances of the same wave that differ only by the lepton helicities
+typedef struct {
+
+	complex<GDouble> helP;
+	complex<GDouble> helM;
+
+} HadronicAmplitudes;
+
+/*Hadronic amplitudes of one calcAmplitudeAll pass, indexed by iPermutation * nEvents + iEvent. They are shared only if exactly two instances
+ evaluate the wave, the mirrored pair: the first one that ran is the producer and fills them, the other one uses them right after,
+ over the same data block, and clears the cache. The lock is held for the whole pass of an instance.*/
+struct HadronicCache {
+
+	vector<HadronicAmplitudes> amps;
+	const GDouble *data;   //data block of the stored pass
+	const void *producer;  //the instance that computed them
+	bool fresh;            //not yet used by a sibling instance
+	vector<const void*> instances; //the instances that evaluated the wave, in the order of their first pass
+	std::mutex lock;
+
+	HadronicCache() :
+			data(0), producer(0), fresh(false) {
+	}
+
+};
+
 class Kinematics;
 
 template<class T> class Clas12PhotonsAmplitude: public UserAmplitude<T> { //Inherits from UserAmplitude.
@@ -46,10 +71,16 @@ public:
 		I.real(0.);
 		I.imag(1.);
 
+		m_shareHadronicAmplitudes = true;
 	}
 	Clas12PhotonsAmplitude<T>(const vector<string>& args);
 
 	virtual ~Clas12PhotonsAmplitude<T>() {
+		if (m_hadronicCache) {
+			std::lock_guard<std::mutex> guard(m_hadronicCache->lock);
+			vector<const void*> &instances = m_hadronicCache->instances;
+			instances.erase(remove(instances.begin(), instances.end(), this), instances.end());
+		}
 	}
 
 	string name() const {
@@ -58,28 +89,136 @@ public:
 
 	complex<GDouble> calcAmplitude(GDouble** pKin) const;
 
+	//factory used by AmpTools to create the amplitude from the configuration arguments: the (+-1,+-1) helicity configurations are mapped
+	//to the compile-time specialization Clas12PhotonsFixedHelicityAmplitude<T,helicityBeam,helicityElectron>, anything else to T.
+	Amplitude* newAmplitude(const vector<string>& args) const;
+
+	//true if the amplitude is 0 for any event (helicity-flip configurations): calcAmplitudeAll then skips the evaluation
+	virtual bool isIdenticallyZero() const {
+		return m_helicity_beam != m_helicity_electron;
+	}
+
+	/*Per-event user variables (AmpTools >= 0.10): the leptonic current and the helicity frame only depend on the kinematics,
+	 hence they are computed once per event by calcUserVars and only calcHelicityAmplitude is re-evaluated when the parameters change.
+	 The base class uses the first kNumUserVars entries: a derived amplitude with its own user variables has to return
+	 Clas12PhotonsAmplitude<T>::numUserVars() + its own number, call Clas12PhotonsAmplitude<T>::calcUserVars first and store its
+	 variables from userVars[kNumUserVars] on.
+	 The variables are the same for all the helicity configurations, so they are declared static: AmpTools computes and stores them
+	 once per event for all the instances of the amplitude. A derived amplitude whose own variables depend on its arguments must
+	 override areUserVarsStatic() to return false.*/
+	enum UserVars {
+		kJPre = 0, kJPim, kJMre, kJMim, //leptonic current, J0 is always 0
+		kFrameX, kFrameY = kFrameX + 3, kFrameZ = kFrameY + 3, //helicity frame basis, lab components
+		kNumUserVars = kFrameZ + 3
+	};
+
+	unsigned int numUserVars() const {
+		return kNumUserVars;
+	}
+	bool areUserVarsStatic() const {
+		return true;
+	}
+	void calcUserVars(GDouble** pKin, GDouble* userVars) const;
+	complex<GDouble> calcAmplitude(GDouble** pKin, GDouble* userVars) const;
+
 	int calcElectronScattering(GDouble** pKin, ElectronScatteringTerm &ElectronScattering) const;
+	int calcElectronScattering(GDouble** pKin, int helicityBeam, int helicityElectron, ElectronScatteringTerm &ElectronScattering) const;
+	//batch version: pdData is a block of iNEvents events in the AmpTools layout (E,px,py,pz for each particle), JP,J0,JM are filled for each event
+	int calcElectronScatteringBatch(const GDouble* pdData, int iNEvents, int iNParticles, complex<GDouble>* JP, complex<GDouble>* J0, complex<GDouble>* JM) const;
 	virtual complex<GDouble> calcHelicityAmplitude(int helicity, GDouble** pKin) const = 0; //this will be derived by the user in his amplitude!!!
 
+	//called when the user variables are available. The default forwards to the version above: the user can override this one
+	//to use the precomputed quantities, for example the hadronic momenta in the helicity frame through getHelicityFrameMomentum
+	virtual complex<GDouble> calcHelicityAmplitude(int helicity, GDouble** pKin, GDouble* /*userVars*/) const {
+		return calcHelicityAmplitude(helicity, pKin);
+	}
+
+	//4-momentum (E,px,py,pz) of particle ip in the helicity frame: virtual photon along +z, hadronic plane xz
+	static void getHelicityFrameMomentum(GDouble** pKin, const GDouble* userVars, int ip, GDouble* P);
+
+	/*CPU batch execution: AmpTools hands the whole event block and the amplitude buffer to calcAmplitudeAll, that splits the events
+	 in contiguous ranges, one per thread. The threads are started once per call and launchCPUKernel runs over all the permutations of a range.
+
+	 Thread-safety contract for the user code: calcHelicityAmplitude (both versions) and, if overridden, calcAmplitude are called
+	 concurrently for different events on the same instance. They must only read the instance (no mutable members used as scratch,
+	 AmpParameter values are only read), and must not use non thread-safe global state, for example gRandom or a shared histogram.
+	 Local TLorentzVector objects are fine. getCurrentPermutation() is not updated in this path.
+	 Use setNumThreads(1) to go back to the serial evaluation.*/
+	void calcAmplitudeAll(GDouble* pdData, GDouble* pdAmps, int iNEvents, const vector<vector<int> >* pvPermutations, GDouble* pdUserVars) const;
+	void launchCPUKernel(GDouble* pdData, GDouble* pdUserVars, GDouble* pdAmps, const vector<vector<int> >* pvPermutations, int iNEvents, int iFirst, int iLast,
+			HadronicAmplitudes* pHadronic = 0, bool useHadronic = false) const;
+
+	static void setNumThreads(int n) {
+		numThreads() = n;
+	}
+
 private:
 	complex<GDouble> One;
 	complex<GDouble> I;
 
-#ifdef GPU_ACCELERATION
+	void evalHadronicAmplitudes(GDouble** pKin, GDouble* userVars, complex<GDouble> &helP, complex<GDouble> &helM) const;
+	mutable shared_ptr<HadronicCache> m_hadronicCache;
 
-	void launchGPUKernel( dim3 dimGrid, dim3 dimBlock, GPU_AMP_PROTO ) const;
+	HadronicCache* getHadronicCache() const;
 
-	bool isGPUEnabled() const {return true;}
+	//cache entry of the event being evaluated by this thread, set by launchCPUKernel. If use is true the entry is read, otherwise it is filled
+	struct HadronicSlot {
+		HadronicAmplitudes *entry;
+		bool use;
+	};
+	static HadronicSlot& hadronicSlot() {
+		static thread_local HadronicSlot slot = { 0, false };
+		return slot;
+	}
 
-#endif // GPU_ACCELERATION
+	//number of threads used by calcAmplitudeAll, shared by all the amplitudes. 0 means all the cores
+	static int& numThreads() {
+		static int n = 0;
+		return n;
+	}
 
 private:
 
 protected:
+	//user helicity amplitudes +1 and -1 (the 0 one is never needed), through the cache shared by the sibling instances
+	void calcHadronicAmplitudes(GDouble** pKin, GDouble* userVars, complex<GDouble> &helP, complex<GDouble> &helM) const;
+
 	//it's important that they're protected, NOT private.
 	int m_helicity_beam;     //beam helicity
 	int m_helicity_electron; //scattered electron helicity
 
+	//if true (default), the hadronic amplitudes of an event are computed once for the (+1,+1) and (-1,-1) instances of the same wave.
+	//A derived amplitude whose calcHelicityAmplitude depends on m_helicity_beam / m_helicity_electron must disable it.
+	bool m_shareHadronicAmplitudes;
+
+	void setShareHadronicAmplitudes(bool flag) {
+		m_shareHadronicAmplitudes = flag;
+	}
+
+};
+
+/*Version of the user amplitude T with the two helicities fixed at compile time: it is what Clas12PhotonsAmplitude<T>::newAmplitude creates,
+ so the user code does not change. The leptonic part reduces to a straight-line kernel, the closed form
+ of Clas12PhotonsLeptonicCurrent, while the helicity-flip configurations are skipped by calcAmplitudeAll.*/
+template<class T, int helicityBeam, int helicityElectron> class Clas12PhotonsFixedHelicityAmplitude: public T {
+
+public:
+
+	Clas12PhotonsFixedHelicityAmplitude(const vector<string>& args) :
+			T(args) {
+	}
+
+	Amplitude* clone() const {
+		return new Clas12PhotonsFixedHelicityAmplitude<T, helicityBeam, helicityElectron>(*this);
+	}
+
+	complex<GDouble> calcAmplitude(GDouble** pKin) const;
+	complex<GDouble> calcAmplitude(GDouble** pKin, GDouble* userVars) const;
+
+	bool isIdenticallyZero() const {
+		return helicityBeam != helicityElectron;
+	}
+
 };
 
 #include "Clas12PhotonsAmplitude.tpp"
@@ -22,6 +22,7 @@ template<class T> Clas12PhotonsAmplitude<T>::Clas12PhotonsAmplitude(const vector
 	I.real(0.);
 	I.imag(1.);
 
+	m_shareHadronicAmplitudes = true;
 }
 
 //the order of the particles is supposed to be:
@@ -34,6 +35,10 @@ template<class T> Clas12PhotonsAmplitude<T>::Clas12PhotonsAmplitude(const vector
 //This ordering is convenient for the helicity!!
 
 template<class T> int Clas12PhotonsAmplitude<T>::calcElectronScattering(GDouble** pKin, ElectronScatteringTerm &ElectronScattering) const {
+	return calcElectronScattering(pKin, m_helicity_beam, m_helicity_electron, ElectronScattering);
+}
+
+template<class T> int Clas12PhotonsAmplitude<T>::calcElectronScattering(GDouble** pKin, int helicityBeam, int helicityElectron, ElectronScatteringTerm &ElectronScattering) const {
 
 	const int Ibeam = 0;
 	const int Iscattered = 1;
@@ -110,24 +115,24 @@ template<class T> int Clas12PhotonsAmplitude<T>::calcElectronScattering(GDouble*
 	Pg = gamma.Z(); //quasi real photon momentum (Purely along z)
 	Mg = sqrt(Pg * Pg - Eg * Eg);
 
-	if ((m_helicity_beam == 1) && (m_helicity_electron == 1)) {
+	if ((helicityBeam == 1) && (helicityElectron == 1)) {
 
 		ElectronScattering.JP = 2. * sqrt(2. * E1 * E2) * cos(theta1 / 2) * sin(theta2 / 2) * exp(-I * phi2);
 		ElectronScattering.JM = -2. * sqrt(2. * E1 * E2) * cos(theta2 / 2) * sin(theta1 / 2) * exp(I * phi1);
 
 		ElectronScattering.J0 = 0.;
 
-	} else if ((m_helicity_beam == 1) && (m_helicity_electron == -1)) {
+	} else if ((helicityBeam == 1) && (helicityElectron == -1)) {
 		ElectronScattering.JP = 0;
 		ElectronScattering.JM = 0;
 		ElectronScattering.J0 = 0;
-	} else if ((m_helicity_beam == -1) && (m_helicity_electron == 1)) {
+	} else if ((helicityBeam == -1) && (helicityElectron == 1)) {
 		ElectronScattering.JP = 0;
 		ElectronScattering.JM = 0;
 		ElectronScattering.J0 = 0;
 	}
 
-	else if ((m_helicity_beam == -1) && (m_helicity_electron == -1)) {
+	else if ((helicityBeam == -1) && (helicityElectron == -1)) {
 
 		ElectronScattering.JP = 2. * sqrt(2. * E1 * E2) * cos(theta2 / 2) * sin(theta1 / 2) * exp(-I * phi1);
 		ElectronScattering.JM = -2. * sqrt(2. * E1 * E2) * cos(theta1 / 2) * sin(theta2 / 2) * exp(I * phi2);
@@ -142,17 +147,25 @@ template<class T> int Clas12PhotonsAmplitude<T>::calcElectronScattering(GDouble*
 return 0;
 }
 
+template<class T> int Clas12PhotonsAmplitude<T>::calcElectronScatteringBatch(const GDouble* pdData, int iNEvents, int iNParticles, complex<GDouble>* JP, complex<GDouble>* J0,
+		complex<GDouble>* JM) const {
+
+	Clas12PhotonsLeptonicCurrent::calcBatch(pdData, iNEvents, iNParticles, m_helicity_beam, m_helicity_electron, JP, J0, JM);
+	return 0;
+}
+
 template<class T> complex<GDouble> Clas12PhotonsAmplitude<T>::calcAmplitude(GDouble** pKin) const {
 
 	complex < GDouble > helP;
-	complex < GDouble > hel0;
 	complex < GDouble > helM;
 	complex < GDouble > amp;
 
-	//calculate the photoproduction part of the amplitude trough the code provided by the user
-	helP = calcHelicityAmplitude(1, pKin);
-	hel0 = calcHelicityAmplitude(0, pKin);
-	helM = calcHelicityAmplitude(-1, pKin);
+	//helicity-flip configurations: the current is 0, no need to call the user code
+	if (m_helicity_beam != m_helicity_electron) return complex < GDouble > (0., 0.);
+
+	//calculate the photoproduction part of the amplitude trough the code provided by the user.
+	//J0 is always 0, hence the helicity 0 amplitude is not needed
+	calcHadronicAmplitudes(pKin, 0, helP, helM);
 
 	//trigger the calculation of the electron scattering part.
 	//This fills the JP,J0,JM complex numbers
@@ -160,9 +173,9 @@ template<class T> complex<GDouble> Clas12PhotonsAmplitude<T>::calcAmplitude(GDou
 	calcElectronScattering(pKin, ElectronScattering);
 
 	//Note that the 1/Q2 factor is already included in JP,J0,JM
-	amp = helP * ElectronScattering.JP + hel0 * ElectronScattering.J0 + helM * ElectronScattering.JM;
+	amp = helP * ElectronScattering.JP + helM * ElectronScattering.JM;
 
-/*	cout<<"HEL:: "<<helP<<" "<< ElectronScattering.JP <<" "<<hel0<<" "<< ElectronScattering.J0 << " "<<helM <<" "<<ElectronScattering.JM<<endl;
+/*	cout<<"HEL:: "<<helP<<" "<< ElectronScattering.JP <<" "<< ElectronScattering.J0 << " "<<helM <<" "<<ElectronScattering.JM<<endl;
 	cout<<"HEL:: "<<amp<<" "<< m_helicity_beam<<" "<< m_helicity_electron<<" "<<endl;
 	cout<<"HEL2:: "<<std::norm(amp)<<endl;
 	cin.get();*/
@@ -170,3 +183,252 @@ template<class T> complex<GDouble> Clas12PhotonsAmplitude<T>::calcAmplitude(GDou
 
 }
 
+/*The hadronic amplitudes do not depend on the lepton helicities, so the instances of the same wave (same name and same user arguments)
+ share them through a cache that lives for one calcAmplitudeAll pass, see calcAmplitudeAll. Outside of it they are always computed.*/
+template<class T> void Clas12PhotonsAmplitude<T>::calcHadronicAmplitudes(GDouble** pKin, GDouble* userVars, complex<GDouble> &helP, complex<GDouble> &helM) const {
+
+	HadronicSlot &slot = hadronicSlot();
+	if (slot.entry == 0) {
+		evalHadronicAmplitudes(pKin, userVars, helP, helM);
+	} else if (slot.use) {
+		helP = slot.entry->helP;
+		helM = slot.entry->helM;
+	} else {
+		evalHadronicAmplitudes(pKin, userVars, helP, helM);
+		slot.entry->helP = helP;
+		slot.entry->helM = helM;
+	}
+}
+
+//one cache per wave, owned by its instances: it goes away with the last of them
+template<class T> HadronicCache* Clas12PhotonsAmplitude<T>::getHadronicCache() const {
+	static map<string, weak_ptr<HadronicCache> > caches;
+	static std::mutex cachesLock;
+
+	std::lock_guard<std::mutex> guard(cachesLock);
+	if (!m_hadronicCache) {
+		string key = this->name();
+		for (unsigned int iarg = 2; iarg < this->arguments().size(); iarg++)
+			key += " " + this->arguments()[iarg];
+		weak_ptr<HadronicCache> &cache = caches[key];
+		m_hadronicCache = cache.lock();
+		if (!m_hadronicCache) {
+			m_hadronicCache = make_shared<HadronicCache>();
+			cache = m_hadronicCache;
+		}
+	}
+	return m_hadronicCache.get();
+}
+
+template<class T> void Clas12PhotonsAmplitude<T>::evalHadronicAmplitudes(GDouble** pKin, GDouble* userVars, complex<GDouble> &helP, complex<GDouble> &helM) const {
+	if (userVars) {
+		helP = calcHelicityAmplitude(1, pKin, userVars);
+		helM = calcHelicityAmplitude(-1, pKin, userVars);
+	} else {
+		helP = calcHelicityAmplitude(1, pKin);
+		helM = calcHelicityAmplitude(-1, pKin);
+	}
+}
+
+//The user variables do not depend on the helicities of this instance: the (+1,+1) current is stored,
+//the (-1,-1) one follows from it and the helicity-flip ones are 0. See calcAmplitude.
+template<class T> void Clas12PhotonsAmplitude<T>::calcUserVars(GDouble** pKin, GDouble* userVars) const {
+
+	ElectronScatteringTerm ElectronScattering;
+	calcElectronScattering(pKin, 1, 1, ElectronScattering);
+
+	userVars[kJPre] = ElectronScattering.JP.real();
+	userVars[kJPim] = ElectronScattering.JP.imag();
+	userVars[kJMre] = ElectronScattering.JM.real();
+	userVars[kJMim] = ElectronScattering.JM.imag();
+
+	Clas12PhotonsLeptonicCurrent::calcHelicityFrame(pKin, &(userVars[kFrameX]));
+}
+
+template<class T> complex<GDouble> Clas12PhotonsAmplitude<T>::calcAmplitude(GDouble** pKin, GDouble* userVars) const {
+
+	complex < GDouble > helP;
+	complex < GDouble > helM;
+
+	complex < GDouble > JP;
+	complex < GDouble > JM;
+
+	//helicity-flip configurations: the current is 0, no need to call the user code
+	if (m_helicity_beam != m_helicity_electron) return complex < GDouble > (0., 0.);
+
+	//JP(-1,-1) = -conj(JM(+1,+1)), JM(-1,-1) = -conj(JP(+1,+1))
+	if ((m_helicity_beam == 1) && (m_helicity_electron == 1)) {
+		JP = complex < GDouble > (userVars[kJPre], userVars[kJPim]);
+		JM = complex < GDouble > (userVars[kJMre], userVars[kJMim]);
+	} else if ((m_helicity_beam == -1) && (m_helicity_electron == -1)) {
+		JP = complex < GDouble > (-userVars[kJMre], userVars[kJMim]);
+		JM = complex < GDouble > (-userVars[kJPre], userVars[kJPim]);
+	}
+
+	//the only part that depends on the parameters. J0 is always 0, hence the helicity 0 amplitude is not needed
+	calcHadronicAmplitudes(pKin, userVars, helP, helM);
+
+	return helP * JP + helM * JM;
+}
+
+template<class T> void Clas12PhotonsAmplitude<T>::getHelicityFrameMomentum(GDouble** pKin, const GDouble* userVars, int ip, GDouble* P) {
+
+	const GDouble *x = &(userVars[kFrameX]);
+	const GDouble *y = &(userVars[kFrameY]);
+	const GDouble *z = &(userVars[kFrameZ]);
+
+	P[0] = pKin[ip][0];
+	P[1] = pKin[ip][1] * x[0] + pKin[ip][2] * x[1] + pKin[ip][3] * x[2];
+	P[2] = pKin[ip][1] * y[0] + pKin[ip][2] * y[1] + pKin[ip][3] * y[2];
+	P[3] = pKin[ip][1] * z[0] + pKin[ip][2] * z[1] + pKin[ip][3] * z[2];
+}
+
+template<class T> Amplitude* Clas12PhotonsAmplitude<T>::newAmplitude(const vector<string>& args) const {
+	assert(args.size() >= 2);
+	int helicityBeam = atoi(args[0].c_str());
+	int helicityElectron = atoi(args[1].c_str());
+
+	if ((helicityBeam == 1) && (helicityElectron == 1)) return new Clas12PhotonsFixedHelicityAmplitude<T, 1, 1>(args);
+	else if ((helicityBeam == 1) && (helicityElectron == -1)) return new Clas12PhotonsFixedHelicityAmplitude<T, 1, -1>(args);
+	else if ((helicityBeam == -1) && (helicityElectron == 1)) return new Clas12PhotonsFixedHelicityAmplitude<T, -1, 1>(args);
+	else if ((helicityBeam == -1) && (helicityElectron == -1)) return new Clas12PhotonsFixedHelicityAmplitude<T, -1, -1>(args);
+	return new T(args);
+}
+
+template<class T, int helicityBeam, int helicityElectron> complex<GDouble> Clas12PhotonsFixedHelicityAmplitude<T, helicityBeam, helicityElectron>::calcAmplitude(GDouble** pKin) const {
+
+	complex < GDouble > helP;
+	complex < GDouble > helM;
+	ElectronScatteringTerm ElectronScattering;
+
+	if (helicityBeam != helicityElectron) return complex < GDouble > (0., 0.);
+
+	this->calcHadronicAmplitudes(pKin, 0, helP, helM);
+
+	//always the closed form, checked against the rotations by checks/checkLeptonicCurrent
+	Clas12PhotonsLeptonicCurrent::calcEvent<helicityBeam, helicityElectron>(pKin, ElectronScattering.JP, ElectronScattering.J0, ElectronScattering.JM);
+
+	return helP * ElectronScattering.JP + helM * ElectronScattering.JM;
+}
+
+template<class T, int helicityBeam, int helicityElectron> complex<GDouble> Clas12PhotonsFixedHelicityAmplitude<T, helicityBeam, helicityElectron>::calcAmplitude(GDouble** pKin,
+		GDouble* userVars) const {
+
+	complex < GDouble > helP;
+	complex < GDouble > helM;
+
+	if (helicityBeam != helicityElectron) return complex < GDouble > (0., 0.);
+
+	this->calcHadronicAmplitudes(pKin, userVars, helP, helM);
+
+	//the user variables hold the (+1,+1) current, see Clas12PhotonsAmplitude<T>::calcAmplitude
+	if (helicityBeam == 1) return helP * complex < GDouble > (userVars[T::kJPre], userVars[T::kJPim]) + helM * complex < GDouble > (userVars[T::kJMre], userVars[T::kJMim]);
+	else return helP * complex < GDouble > (-userVars[T::kJMre], userVars[T::kJMim]) + helM * complex < GDouble > (-userVars[T::kJPre], userVars[T::kJPim]);
+}
+
+template<class T> void Clas12PhotonsAmplitude<T>::calcAmplitudeAll(GDouble* pdData, GDouble* pdAmps, int iNEvents, const vector<vector<int> >* pvPermutations,
+		GDouble* pdUserVars) const {
+
+	int iNPermutations = pvPermutations->size();
+	assert(iNPermutations);
+	assert(pvPermutations->at(0).size());
+
+	//helicity-flip configurations: nothing to evaluate
+	if (this->isIdenticallyZero()) {
+		fill(pdAmps, pdAmps + 2 * (size_t) iNEvents * iNPermutations, (GDouble) 0);
+		return;
+	}
+
+	//AmpTools evaluates the amplitudes of a data block one after the other, always in the same order: the producer of the mirrored pair
+	//runs first and stores its hadronic amplitudes, the other one uses them. With a single instance there is nobody to share with,
+	//with three or more an entry could be used a pass later, with older parameters or events: no sharing in both cases
+	HadronicCache *cache = 0;
+	std::unique_lock<std::mutex> guard;
+	bool use = false;
+	if (m_shareHadronicAmplitudes) {
+		cache = getHadronicCache();
+		guard = std::unique_lock<std::mutex>(cache->lock);
+		if (find(cache->instances.begin(), cache->instances.end(), this) == cache->instances.end()) cache->instances.push_back(this);
+		if (cache->instances.size() != 2) {
+			cache->amps.clear();
+			cache->fresh = false;
+			cache->producer = 0;
+			cache->data = 0;
+			guard.unlock();
+			cache = 0;
+		} else if (cache->instances[0] == this) {
+			cache->amps.resize((size_t) iNEvents * iNPermutations);
+		} else {
+			use = cache->fresh && (cache->producer == cache->instances[0]) && (cache->data == pdData) && (cache->amps.size() == (size_t) iNEvents * iNPermutations);
+			if (!use) {
+				guard.unlock();
+				cache = 0;
+			}
+		}
+	}
+	HadronicAmplitudes *pHadronic = cache ? cache->amps.data() : 0;
+
+	//below this, a thread is not worth starting
+	const int minEventsPerThread = 1000;
+
+	int nThreads = numThreads();
+	if (nThreads <= 0) nThreads = std::thread::hardware_concurrency();
+	if (nThreads > iNEvents / minEventsPerThread) nThreads = iNEvents / minEventsPerThread;
+	if (nThreads < 1) nThreads = 1;
+
+	//the threads are started once per pass, each one runs over all the permutations of its events
+	if (nThreads == 1) {
+		launchCPUKernel(pdData, pdUserVars, pdAmps, pvPermutations, iNEvents, 0, iNEvents, pHadronic, use);
+	} else {
+		vector<std::thread> threads;
+		for (int ithread = 0; ithread < nThreads; ithread++)
+			threads.push_back(
+					std::thread(&Clas12PhotonsAmplitude<T>::launchCPUKernel, this, pdData, pdUserVars, pdAmps, pvPermutations, iNEvents,
+							(int) ((long) iNEvents * ithread / nThreads), (int) ((long) iNEvents * (ithread + 1) / nThreads), pHadronic, use));
+		for (int ithread = 0; ithread < nThreads; ithread++)
+			threads[ithread].join();
+	}
+
+	if (cache == 0) return;
+	if (use) {
+		cache->amps.clear();
+		cache->fresh = false;
+		cache->producer = 0;
+		cache->data = 0;
+	} else {
+		cache->producer = this;
+		cache->data = pdData;
+		cache->fresh = true;
+	}
+}
+
+template<class T> void Clas12PhotonsAmplitude<T>::launchCPUKernel(GDouble* pdData, GDouble* pdUserVars, GDouble* pdAmps, const vector<vector<int> >* pvPermutations, int iNEvents,
+		int iFirst, int iLast, HadronicAmplitudes* pHadronic, bool useHadronic) const {
+
+	int iNPermutations = pvPermutations->size();
+	int iNParticles = pvPermutations->at(0).size();
+	unsigned int numVars = this->numUserVars();
+
+	vector<GDouble*> pKin(iNParticles);
+	complex<GDouble> cRes;
+	HadronicSlot &slot = hadronicSlot();
+	slot.use = useHadronic;
+
+	for (int iPermutation = 0; iPermutation < iNPermutations; iPermutation++) {
+		const int *piPerm = &(pvPermutations->at(iPermutation)[0]);
+		GDouble *pdPermAmps = &(pdAmps[2 * (size_t) iNEvents * iPermutation]);
+		GDouble *pdPermUserVars = (numVars != 0) ? &(pdUserVars[(size_t) iNEvents * iPermutation * numVars]) : 0;
+		HadronicAmplitudes *pPermHadronic = pHadronic ? &(pHadronic[(size_t) iNEvents * iPermutation]) : 0;
+
+		for (int iEvent = iFirst; iEvent < iLast; iEvent++) {
+			for (int iParticle = 0; iParticle < iNParticles; iParticle++)
+				pKin[iParticle] = &(pdData[4 * iNParticles * iEvent + 4 * piPerm[iParticle]]);
+			slot.entry = pPermHadronic ? &(pPermHadronic[iEvent]) : 0;
+			if (numVars != 0) cRes = this->calcAmplitude(&(pKin[0]), &(pdPermUserVars[iEvent * numVars]));
+			else cRes = this->calcAmplitude(&(pKin[0]));
+			pdPermAmps[2 * iEvent] = cRes.real();
+			pdPermAmps[2 * iEvent + 1] = cRes.imag();
+		}
+	}
+	slot.entry = 0;
+}
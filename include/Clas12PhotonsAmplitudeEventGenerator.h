@@ -6,8 +6,9 @@
 #include "TVector3.h"
 #include "TGenPhaseSpace.h"
 #include "TRandom3.h"
-
-#include "IUAmpTools/Kinematics.h"
+#include "Clas12PhotonsRandom.h"
+#include "Clas12PhotonsEventStore.h"
+#include "Clas12PhotonsEventView.h"
 
 using namespace std;
 
@@ -15,6 +16,8 @@ class TH1D;
 class ReactionInfo;
 class TDatabasePDG;
 class Clas12PhotonsPSEventGenerator;
+class Clas12PhotonsEventSink;
+class Clas12PhotonsPSPipeline;
 class AmpToolsInterface;
 
 class Clas12PhotonsAmplitudeEventGenerator {
@@ -24,22 +27,89 @@ public:
 	Clas12PhotonsAmplitudeEventGenerator(const string &cfgfile, int Nevents);
 	~Clas12PhotonsAmplitudeEventGenerator();
 
-	void setSeed(double seed) {
-		m_seed = seed;
-		gRandom->SetSeed(m_seed);
-	}
+	//the same seed is used by the PS generator. All the random numbers are drawn from Clas12PhotonsRandom streams,
+	//so the generated sample does not depend on the number of threads
+	void setSeed(double seed);
 
 	void setEbeam(double ebeam);
 	void GenerateEvents();
 	void GenerateEvents(int Nevents);
 
+	/*Streaming generation: the PS events are generated, loaded in AmpTools and accepted block by block, and each accepted event goes
+	 straight to the sink, nothing is kept: the memory is set by the block size. Generation stops at Nevents events (or when the sink says so).
+	 An event already written can't be thinned, so the hit-or-miss uses the max intensity of the efficiency computation times
+	 setStreamingMaxFactor (default 1.2). An event above it is kept with weight intensity / max, and counted in GetOverweightEvents.
+	 In weighted mode all the events are written, with the raw weights: the normalization is in the weight summary.*/
+	void GenerateEvents(Clas12PhotonsEventSink &sink);
+	void setStreamingMaxFactor(double f) {
+		m_streamMaxFactor = f;
+	}
+	long GetOverweightEvents() const {
+		return m_nOverweight;
+	}
+
+	//PS events are generated in parallel, and loaded in AmpTools, in blocks of this size. Default is 100000
+	void setBlockSize(int n) {
+		m_PSblockSize = n;
+	}
+	//during the generation, a producer thread generates the next PS blocks while AmpTools computes the intensities of the current one:
+	//at most this number of blocks wait in the queue (default 2). 0 generates them in the same thread, one after the other
+	void setPipelineDepth(int n) {
+		m_pipelineDepth = n;
+	}
+
 
 	void setEfficiencySaverdMin(int n) {
 		m_savedMin = n;
 	}
+	//target relative error on the efficiency
+	void setEfficiencyPrecision(double p) {
+		m_efficiencyPrecision = p;
+	}
+
+	/*Adaptive proposal: before the efficiency computation, the PS generator proposal grid (see Clas12PhotonsPSEventGenerator::enableProposal)
+	 is trained for nIterations iterations of nEvents PS events each, on the intensity. The events are then sampled close to the intensity,
+	 and the hit-or-miss is done on intensity times jacobian: the efficiency is larger and far fewer amplitudes are computed per accepted event.
+	 0 iterations (default) keeps the flat phase space proposal.*/
+	void setAdaptiveProposal(int nIterations, int nEvents, int nBins = 50);
 	void computeEfficiency();
 	double GetEfficiency();
 
+	/*Calibration checkpoint: efficiency, max intensity, t-weight histogram and W distribution, with a hash of the configuration
+	 (config file content, masses, beam energy, PS generator limits, t-weight settings). saveCalibration computes the efficiency if
+	 not yet done. loadCalibration refuses a file with a different hash; after loading, GenerateEvents goes straight to the generation.*/
+	bool saveCalibration(const string &fname);
+	bool loadCalibration(const string &fname);
+
+	/*Weighted mode: GenerateEvents keeps all the Nevents PS events, without the hit-or-miss on the intensity, and GetWeight returns
+	 intensity (times the t-weight, if enabled), normalized so that the average is 1: this is the weight to write in the LUND header.
+	 The efficiency is not needed. The PS events themselves are still unweighted, the phase-space accept/reject is cheap and does not
+	 evaluate the amplitude. The normalization is given by the weight summary.*/
+	void setWeighted(bool flag) {
+		m_weighted = flag;
+		m_GenerationDone = false;
+	}
+	bool getWeighted() const {
+		return m_weighted;
+	}
+
+	//sums of the raw weights of the weighted sample, before the normalization to average 1
+	double GetWeightSum() const {
+		return m_weightSum;
+	}
+	double GetWeight2Sum() const {
+		return m_weight2Sum;
+	}
+	double GetWeightMax() const {
+		return m_weightMax;
+	}
+	//effective number of events (sum w)^2 / sum w^2
+	double GetEffectiveEvents() const {
+		return (m_weight2Sum > 0) ? m_weightSum * m_weightSum / m_weight2Sum : 0;
+	}
+	//writes the summary to a text file, to go with the LUND file
+	bool writeWeightSummary(const string &fname) const;
+
 	inline void SetNt(int nt){m_Nt=nt;}
 	void EnableTweight();
 	void DisableTweight();
@@ -48,14 +118,60 @@ public:
 		m_safetyFactor = f;
 	}
 
+	//threads used for the phase-space generation, 0 means all the cores
+	void setNumThreads(int n);
+
+	/*If false, the PS events are not kept in memory: only their index in the PS generator is saved (and, for the accepted events, the weight),
+	 and the accepted events are regenerated from the index when requested with GetDecay, GetAllParticlesAmpToolsOrder, GetFinalStateParticles.
+	 The PS generator settings must not be changed between GenerateEvents and the Get methods. Default is true.*/
+	void setStoreEvents(bool flag) {
+		m_storeEvents = flag;
+	}
+	bool getStoreEvents() const {
+		return m_storeEvents;
+	}
+
 	 TLorentzVector GetDecay(int evt,int ip);
 	 double GetWeight(int evt);
 	 vector<TLorentzVector> GetAllParticlesAmpToolsOrder(int evt);
 	 vector<TLorentzVector> GetFinalStateParticles(int evt);
+	 //views of the accepted event evt (see Clas12PhotonsEventView). They are over an event vector of the generator that is reused:
+	 //evt is copied there from the event store, or regenerated without it, once per event. Valid until another event is requested
+	 Clas12PhotonsEventView GetEventView(int evt);
+	 Clas12PhotonsEventView GetFinalStateView(int evt);
 
 
 private:
 
+	//the configuration the calibration depends on, and its hash. False if the configuration file can't be read
+	bool calibrationKey(string &key) const;
+	bool calibrationHash(ULong64_t &hash) const;
+
+	void computeTweight();
+	void generateWeightedEvents();
+	//keeps each accepted event with probability keep, returns how many are left
+	int thinGeneratedEvents(double keep, int iteration);
+	//stores an accepted event, with its t-weight and intensity
+	void addGeneratedEvent(const vector<TLorentzVector> &vP, ULong64_t index, double intensity);
+	//the t-weight of an event in the AmpTools order, 1 if disabled
+	double getTweight(const vector<TLorentzVector> &vP) const;
+
+	//generates N PS events, in the AmpTools order, applying the t-weight if enabled. If indices is given, the PS generator index of each event is appended.
+	//jacobians and inputs get the proposal jacobian and grid inputs of each event (see Clas12PhotonsPSEventGenerator::GenerateBlock),
+	//the jacobian includes the t-weight
+	void generatePSEvents(int N, vector<vector<TLorentzVector> > &events, vector<ULong64_t> *indices = 0, vector<double> *jacobians = 0, vector<double> *inputs = 0);
+	//the same from the PS event firstEvent on, without moving the PS generator index: safe in the producer thread
+	void generatePSEvents(int N, ULong64_t firstEvent, vector<vector<TLorentzVector> > &events, vector<ULong64_t> *indices = 0, vector<double> *jacobians = 0, vector<double> *inputs = 0);
+	//starts the producer of the blocks of m_PSblockSize PS events, from the current PS generator index
+	void startPSPipeline(Clas12PhotonsPSPipeline &pipeline);
+	//stops it: the PS generator index goes to nextEvent, the one after the last PS event used, as without the pipeline
+	void stopPSPipeline(Clas12PhotonsPSPipeline &pipeline, ULong64_t nextEvent);
+	void trainProposal();
+	//the t-weight histogram becomes the t distribution of the PS generator
+	void setTsampling();
+	//the accepted event evt, in the AmpTools order: from memory or regenerated
+	const vector<TLorentzVector>& getGeneratedEvent(int evt);
+
 	//helper DB
 	TDatabasePDG *m_dbPDG;
 
@@ -72,11 +188,18 @@ private:
 
 	//seed
 	double m_seed;
+	Clas12PhotonsRandom m_rnd;
+
+	string m_cfgfile;
 
 	//efficiency of the computation
 	double m_efficiency;
+	double m_maxIntensity; //from the efficiency computation. Intensity times proposal jacobian, as all the intensities used for the hit-or-miss
 	bool m_EfficiencyDone;
 	int m_savedMin;
+	double m_efficiencyPrecision;
+	vector<ULong64_t> m_effIndex;  //PS index and intensity of the events of the efficiency computation, reused by GenerateEvents
+	vector<double> m_effIntensity;
 
 	//beam energy
 	double m_Ebeam;
@@ -85,6 +208,7 @@ private:
 	bool m_GenerationDone;
 
 	bool m_doTweight;
+	bool m_TweightDone;
 	int m_Nt;
 	double m_wtMax;
 	TH1D *m_hTweight;
@@ -92,9 +216,34 @@ private:
 	//particles in the final state
 	int m_Np;
 	vector<TLorentzVector> m_vP;
-	vector<Kinematics> m_kinVPS;
-	vector<Kinematics> m_kinVGenerated;
-	vector<double> m_intensities;
+	Clas12PhotonsEventStore m_generated; //accepted events, with the t-weight (the normalized weight in weighted mode) and intensity
+
+	//store-nothing mode
+	bool m_storeEvents;
+	vector<ULong64_t> m_PSindex;        //PS generator index of each PS event in the current block
+	vector<double> m_PSjacobian;        //and its proposal jacobian
+	vector<ULong64_t> m_generatedIndex; //PS generator index of each accepted event
+	vector<float> m_generatedWeight;
+	int m_lastEvent;                    //accepted event currently in m_vP
+
+	int m_PSblockSize;
+	int m_pipelineDepth;
+
+	//streaming
+	double m_streamMaxFactor;
+	long m_nOverweight;
+
+	//adaptive proposal
+	int m_proposalIterations;
+	int m_proposalEvents;
+	int m_proposalBins;
+	bool m_proposalDone;
+
+	//weighted mode
+	bool m_weighted;
+	double m_weightSum;
+	double m_weight2Sum;
+	double m_weightMax;
 
 };
 
@@ -0,0 +1,55 @@
+#ifndef CLAS12PHOTONSCDFSAMPLER
+#define CLAS12PHOTONSCDFSAMPLER
+
+#include <vector>
+
+using namespace std;
+
+/* Inverse-CDF sampling of a 1D distribution, piecewise constant in bins of any width.
+ The cumulative distribution is computed once, then Sample() returns a value inside any [xmin,xmax] sub-range
+ with a single uniform number and no rejection: the uniform is mapped to [CDF(xmin),CDF(xmax)] and the CDF is inverted.
+ A guide table gives the bin of a CDF value without a binary search.
+ The binning is either uniform or adaptive, with the same number of entries in each bin: the bins are narrow where the distribution is large.*/
+
+class Clas12PhotonsCDFSampler {
+
+public:
+
+	Clas12PhotonsCDFSampler() {
+	}
+
+	//builds the distribution from the values in samples (they are sorted in place), in nbins bins from xmin to xmax
+	void Build(vector<double> &samples, double xmin, double xmax, int nbins, bool adaptive);
+	//builds the distribution from the bin edges (nbins + 1) and contents (nbins)
+	void SetDistribution(int nbins, const double *edges, const double *contents);
+
+	double CDF(double x) const;
+	//probability density at x, 0 outside the range
+	double Density(double x) const;
+	//u is a uniform number in [0,1)
+	double Sample(double u) const;
+	double Sample(double u, double xmin, double xmax) const;
+
+	int GetNbins() const {
+		return (int) m_edges.size() - 1;
+	}
+	bool IsEmpty() const {
+		return m_edges.size() < 2;
+	}
+	const vector<double>& GetEdges() const {
+		return m_edges;
+	}
+	const vector<double>& GetCDF() const {
+		return m_cdf;
+	}
+
+private:
+
+	int findBinCDF(double F) const;
+
+	vector<double> m_edges;
+	vector<double> m_cdf;  //CDF at the edges, from 0 to 1
+	vector<int> m_guide;   //m_guide[k]: bin with CDF value k/size
+};
+
+#endif
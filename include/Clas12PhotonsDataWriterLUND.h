@@ -14,44 +14,96 @@
 #include "TLorentzVector.h"
 #include "TVector3.h"
 #include <fstream>
+#include <string>
+#include <unordered_map>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 
 
 class TDatabasePDG;
 class TParticlePDG;
 
+/*The lines are formatted straight into an output buffer, that goes to the file when it is larger than the buffer size
+ (default 4 MB), on flush() and at the end: nothing is flushed per line. The numbers have the same text as with the default
+ ostream formatting (6 significant digits), written without streams, and the charge and mass of each PID are looked up in the PDG
+ database only the first time.
+ Asynchronous mode (setAsync): writeEvent only copies the event into the current batch, and a writer thread formats and writes the full
+ batches while the caller goes on. At most nBuffers batches exist, the one being filled included: when all the others are waiting to be
+ written, writeEvent waits for the writer thread. flush() waits until everything is in the file, close() also stops the thread.
+ An I/O error of the writer thread is returned (false) by the next writeEvent, flush or close.*/
 class Clas12PhotonsDataWriterLUND {
 public:
 	Clas12PhotonsDataWriterLUND(const string& outFile);
 	virtual ~Clas12PhotonsDataWriterLUND();
 
-	void writeEvent( const Kinematics& kin,const vector<TVector3>& vertex,int *pid=0,int *status=0);
-	void writeEvent( const vector<TLorentzVector>& P,const vector<TVector3>& vertex,int *pid=0,int *status=0,double weight=1);
+	//return false if the event is not valid or the file is not good
+	bool writeEvent( const Kinematics& kin,const vector<TVector3>& vertex,int *pid=0,int *status=0);
+	bool writeEvent( const vector<TLorentzVector>& P,const vector<TVector3>& vertex,int *pid=0,int *status=0,double weight=1);
 	int eventCounter() const { return m_eventCounter; }
 
+	//writes the buffer to the file, and flushes it. Returns false if the file is not good
+	bool flush();
+	//flushes, stops the writer thread and closes the file. Called by the destructor
+	bool close();
+	void setBufferSize(size_t n) { m_bufferSize = n; }
+	//batches of batchSize events, nBuffers at least 2
+	void setAsync(int nBuffers = 3, int batchSize = 10000);
+
 private:
 
 	  std::ofstream m_outFile;
 	  int m_eventCounter;
 
+	  /*output buffer*/
+	  string m_buffer;
+	  size_t m_bufferSize;
+
+	  /*charge and mass of each PID, already formatted*/
+	  typedef struct {
+		  string charge;
+		  string mass;
+	  } PIDinfo;
+	  std::unordered_map<int, PIDinfo> m_PIDtable;
+	  const PIDinfo& getPIDinfo(int pid);
+
+	  void header_line(int nP, double weight);
+	  //p has px, py, pz, E and the vertex
+	  void particle_line(int np, const double *p, int pid, int status, const PIDinfo &info);
+	  //appends x as the ostream default formatting does
+	  void append(double x);
+	  void append(int n);
 
-	  /*Variables of current event*/
-	  Kinematics m_kin;                //holds 4-vectors and weight
-	  vector<TVector3> m_vertex; //holds vertexes;
-	  int m_nP;                        //number of particles in current event
-	  int *m_pid;                     //holds particles PID
-	  int *m_status;                  //holds status
-	  
-	  /*strings and methods for these*/
-	  string m_header;
-	  string m_particle;
-
-
-	  void header_line();
-	  void particle_line(int np);
-	  
 	  /*helper DB*/
 	  TDatabasePDG *m_PDGdb;
-	  TParticlePDG *m_PDGparticle;
+
+	  /*asynchronous mode*/
+	  typedef struct {
+		  vector<int> nP;                //particles of each event
+		  vector<double> weight;
+		  vector<double> p;              //px, py, pz, E, vx, vy, vz of each particle
+		  vector<int> pid;
+		  vector<int> status;
+		  vector<const PIDinfo*> info;   //the table entries do not move
+	  } Batch;
+	  bool m_async;
+	  int m_batchSize;
+	  vector<Batch> m_batches;
+	  Batch *m_current;                //filled by the caller
+	  vector<Batch*> m_free;
+	  std::deque<Batch*> m_full;       //waiting for the writer thread
+	  bool m_busy;                     //the writer thread is writing a batch
+	  bool m_closing;
+	  std::atomic<bool> m_failed;      //a write failed, read by writeEvent without the lock
+	  std::thread m_thread;
+	  std::mutex m_mutex;
+	  std::condition_variable m_cond;
+
+	  void submitBatch();
+	  void writerLoop();
+	  void formatBatch(const Batch &batch);
 
 };
 
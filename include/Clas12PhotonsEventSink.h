@@ -0,0 +1,51 @@
+#ifndef CLAS12PHOTONSEVENTSINK
+#define CLAS12PHOTONSEVENTSINK
+
+#include <vector>
+
+#include "TLorentzVector.h"
+#include "TVector3.h"
+
+using namespace std;
+
+class Clas12PhotonsDataWriterLUND;
+
+/* Receiver of the events of a streaming generation (see Clas12PhotonsAmplitudeEventGenerator::GenerateEvents(Clas12PhotonsEventSink&)).
+ Each event is passed as soon as it is accepted, in the AmpTools order (beam, e', target, recoil, others), with its weight:
+ the vector is only valid during the call. writeEvent returns false to stop the generation.*/
+class Clas12PhotonsEventSink {
+
+public:
+
+	virtual ~Clas12PhotonsEventSink() {
+	}
+
+	virtual void begin(int /*nEvents*/) {
+	}
+	virtual bool writeEvent(const vector<TLorentzVector> &event, double weight) = 0;
+	virtual void end() {
+	}
+};
+
+/* Sink writing the final state particles (e', then the others, as GetFinalStateParticles) to a LUND file.
+ pid has the PDG code of each of them. The vertex is the same for all the events, at the origin if not given.
+ An error of the writer stops the generation.*/
+class Clas12PhotonsEventSinkLUND: public Clas12PhotonsEventSink {
+
+public:
+
+	Clas12PhotonsEventSinkLUND(Clas12PhotonsDataWriterLUND &writer, const vector<int> &pid, const vector<TVector3> &vertex = vector<TVector3>());
+
+	virtual bool writeEvent(const vector<TLorentzVector> &event, double weight);
+	//flushes the writer
+	virtual void end();
+
+private:
+
+	Clas12PhotonsDataWriterLUND &m_writer;
+	vector<int> m_pid;
+	vector<TVector3> m_vertex;
+	vector<TLorentzVector> m_P; //final state particles of the current event
+};
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef CLAS12PHOTONSEVENTSTORE
+#define CLAS12PHOTONSEVENTSTORE
+
+#include <vector>
+
+#include "TLorentzVector.h"
+#include "Clas12PhotonsAlignedAllocator.h"
+
+using namespace std;
+
+/* Store of events with a fixed number of particles, by columns: px, py, pz and E of each particle slot are contiguous arrays over the events,
+ as are the weight and the intensity. An event takes 4 doubles per particle plus 2, with no allocation per event, instead of a Kinematics
+ with its own vector of TLorentzVector (TObjects). Append copies an event in, GetEvent copies it out to a vector reused by the caller.
+ The accept flags select the events to keep, Compact() removes the others keeping the order.
+ The columns start on a 64-byte boundary.*/
+class Clas12PhotonsEventStore {
+
+public:
+
+	typedef vector<double, Clas12PhotonsAlignedAllocator<double, 64> > Column;
+
+	Clas12PhotonsEventStore(int nParticles = 0);
+
+	//empties the store, the events have nParticles particles from now on
+	void Init(int nParticles);
+	void Clear();
+	void Reserve(long n);
+
+	//returns the index of the new event, that is accepted
+	long Append(const vector<TLorentzVector> &event, double weight = 1, double intensity = 0);
+
+	long Size() const {
+		return m_weight.size();
+	}
+	int GetNparticles() const {
+		return m_nParticles;
+	}
+
+	void GetEvent(long i, vector<TLorentzVector> &event) const;
+	TLorentzVector GetParticle(long i, int ip) const {
+		return TLorentzVector(m_p[4 * ip][i], m_p[4 * ip + 1][i], m_p[4 * ip + 2][i], m_p[4 * ip + 3][i]);
+	}
+	//component c (0 px, 1 py, 2 pz, 3 E) of particle ip, for all the events
+	const double* GetColumn(int ip, int c) const {
+		return m_p[4 * ip + c].data();
+	}
+
+	double GetWeight(long i) const {
+		return m_weight[i];
+	}
+	void SetWeight(long i, double w) {
+		m_weight[i] = w;
+	}
+	void ScaleWeights(double f);
+	double GetIntensity(long i) const {
+		return m_intensity[i];
+	}
+
+	bool GetAccept(long i) const {
+		return m_accept[i];
+	}
+	void SetAccept(long i, bool accept) {
+		m_accept[i] = accept;
+	}
+	//removes the events not accepted, returns how many are left
+	long Compact();
+
+private:
+
+	int m_nParticles;
+	vector<Column> m_p; //4 columns per particle: px, py, pz, E
+	Column m_weight;
+	Column m_intensity;
+	vector<char> m_accept;
+};
+
+#endif
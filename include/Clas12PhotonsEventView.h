@@ -0,0 +1,60 @@
+#ifndef CLAS12PHOTONSEVENTVIEW
+#define CLAS12PHOTONSEVENTVIEW
+
+#include <vector>
+
+#include "TLorentzVector.h"
+
+using namespace std;
+
+/* Non-owning view of an event held by a generator, that the view itself does not copy: it refers to the event in the AmpTools order (beam, e', target, recoil, others).
+ The final state view shows only e' and the hadrons, in the order of GetFinalStateParticles. A view is valid until the generator
+ moves to another event.*/
+class Clas12PhotonsEventView {
+
+public:
+
+	Clas12PhotonsEventView(const vector<TLorentzVector> &ampToolsOrder, bool finalState = false) :
+			m_event(&ampToolsOrder), m_finalState(finalState) {
+	}
+
+	int size() const {
+		return m_finalState ? (int) m_event->size() - 2 : (int) m_event->size();
+	}
+	const TLorentzVector& operator[](int i) const {
+		if (m_finalState) return (*m_event)[(i == 0) ? 1 : i + 2];
+		return (*m_event)[i];
+	}
+
+	const TLorentzVector& Beam() const {
+		return (*m_event)[0];
+	}
+	const TLorentzVector& Electron() const {
+		return (*m_event)[1];
+	}
+	const TLorentzVector& Target() const {
+		return (*m_event)[2];
+	}
+	const TLorentzVector& Recoil() const {
+		return (*m_event)[3];
+	}
+
+	//the whole event, in the AmpTools order, whatever the view
+	const vector<TLorentzVector>& GetAmpToolsOrder() const {
+		return *m_event;
+	}
+	//copy of the particles of the view
+	vector<TLorentzVector> Copy() const {
+		vector<TLorentzVector> v(this->size());
+		for (int i = 0; i < this->size(); i++)
+			v[i] = (*this)[i];
+		return v;
+	}
+
+private:
+
+	const vector<TLorentzVector> *m_event;
+	bool m_finalState;
+};
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef CLAS12PHOTONSLEPTONICCURRENT
+#define CLAS12PHOTONSLEPTONICCURRENT
+
+#include "GPUManager/GPUCustomTypes.h"
+
+#include <complex>
+
+using std::complex;
+
+/* Batched evaluation of the leptonic current JP,J0,JM used by Clas12PhotonsAmplitude.
+ The input is a block of events in the same layout AmpTools uses internally (pdData):
+ for each event, iNParticles 4-vectors stored as E,px,py,pz, in the order beam, e', target, recoil, others.
+ The events are transposed in small structure-of-arrays blocks and processed with AVX-512 / AVX2 vectors,
+ when the library is compiled for these (make SIMD=avx512 or make SIMD=avx2), or with a scalar loop otherwise.
+
+ The helicity frame (virtual photon along +z, hadronic plane in xz) is built from the photon direction and the recoil
+ momentum component orthogonal to it, so that no atan2/cos/sin are needed: the half-angles and the phases entering
+ the current are obtained directly from the momentum components in that frame.
+ */
+
+class Clas12PhotonsLeptonicCurrent {
+
+public:
+
+	static void calcBatch(const GDouble* pdData, int iNEvents, int iNParticles, int helicityBeam, int helicityElectron, complex<GDouble>* JP, complex<GDouble>* J0, complex<GDouble>* JM);
+
+	//same closed-form evaluation, for a single event given as AmpTools pKin
+	static void calcEvent(GDouble** pKin, int helicityBeam, int helicityElectron, complex<GDouble> &JP, complex<GDouble> &J0, complex<GDouble> &JM);
+
+	//compile-time helicities: instantiated for the four (+-1,+-1) configurations, the helicity-flip ones only set the current to 0
+	template<int helicityBeam, int helicityElectron> static void calcEvent(GDouble** pKin, complex<GDouble> &JP, complex<GDouble> &J0, complex<GDouble> &JM);
+
+	//basis of the helicity frame in lab components: frame[0..2] = x, frame[3..5] = y, frame[6..8] = z
+	static void calcHelicityFrame(GDouble** pKin, GDouble* frame);
+
+	//the instruction set the kernel was compiled for: "AVX-512", "AVX2" or "scalar"
+	static const char* instructionSet();
+
+	//events transposed at once in the SoA buffers
+	static const int blockSize = 64;
+
+};
+
+#endif
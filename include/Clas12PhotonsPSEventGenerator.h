@@ -2,9 +2,15 @@
 #define CLAS12PHOTONSPSEVENTGENERATOR
 
 #include <vector>
+#include <string>
+#include <iostream>
 #include "TLorentzVector.h"
-#include "TGenPhaseSpace.h"
 #include "TRandom3.h"
+#include "Clas12PhotonsPhaseSpace.h"
+#include "Clas12PhotonsRandom.h"
+#include "Clas12PhotonsCDFSampler.h"
+#include "Clas12PhotonsVegasGrid.h"
+#include "Clas12PhotonsEventView.h"
 using namespace std;
 
 class TH1D;
@@ -57,12 +63,57 @@ public:
 	void setSeed(double seed) {
 		m_seed = seed;
 		gRandom->SetSeed(m_seed);
+		m_rnd.SetSeed((ULong64_t) m_seed);
 	}
 
 	const TH1D* getWdistr() const {
 		return m_Wdistr;
 	}
 
+	/*The W distribution used in the generation: nEvents sampled events, nBins bins, uniform or adaptive (same number of events per bin).
+	 Default is 100000 events and 1000 uniform bins.*/
+	void setWdistrSampling(int nEvents, int nBins, bool adaptive) {
+		m_WdistrEvents = nEvents;
+		m_WdistrBins = nBins;
+		m_WdistrAdaptive = adaptive;
+		if (m_Wdistr != 0) this->computeWdistr(); //W distr. was already calculated, need to do again
+	}
+	int getWdistrEvents() const {
+		return m_WdistrEvents;
+	}
+	int getWdistrBins() const {
+		return m_WdistrBins;
+	}
+	bool getWdistrAdaptive() const {
+		return m_WdistrAdaptive;
+	}
+
+	/*Cache of the W distribution (and of the max weight of the W decay) on disk: one file per reaction masses, beam energy and
+	 sampling settings, in the given directory. The entries are looked up before sampling and written after. An empty directory disables it.
+	 The cached distribution was sampled with the seed of the job that wrote it.*/
+	void setWdistrCache(const string &dir) {
+		m_WdistrCacheDir = dir;
+	}
+
+	/*Grid of nPoints beam energies from Emin to Emax: for a beam energy inside the grid that is not in the cache, the W distribution is
+	 interpolated between the two grid points around it, that are computed and cached if needed. Requires the cache.*/
+	void setWdistrEnergyGrid(double Emin, double Emax, int nPoints) {
+		m_WdistrGridEmin = Emin;
+		m_WdistrGridEmax = Emax;
+		m_WdistrGridPoints = nPoints;
+	}
+
+	//computes and caches all the grid points, for example in a setup job before the production
+	void precomputeWdistrGrid();
+
+	//the W distribution for the current beam energy, to a stream and back (used by the calibration checkpoint)
+	void saveWdistr(ostream &out);
+	bool loadWdistr(istream &in);
+
+	const Clas12PhotonsCDFSampler& getWsampler() const {
+		return m_Wsampler;
+	}
+
 	double getEprimeMax() const {
 		return m_EprimeMax;
 	}
@@ -81,7 +132,76 @@ public:
 
 	void setReaction(ReactionInfo *reaction);
 
+	/*The random numbers of each PS event only depend on the seed and on the event index (see Clas12PhotonsRandom),
+	 hence the sample is the same whatever the number of threads, and a job can be split in several ones with setNextEvent.
+	 Generate() produces the next event, GenerateEvent the one with the given index, without changing the next event index.*/
 	void Generate();
+	void GenerateEvent(ULong64_t index);
+
+	/*Parallel generation: fills all the events of the block, each in the AmpTools order (see GetAllParticlesAmpToolsOrder).
+	 Every thread has its own random generator, phase-space generator and scratch vector.
+	 The first version uses the events from the next event index on and advances it, the second uses the events from firstEvent on.
+	 If given, jacobian gets the jacobian of each event (1 without the proposal grid), and inputs the getProposalDim() grid inputs
+	 of each event (only filled with the proposal grid).*/
+	void GenerateBlock(vector<vector<TLorentzVector> > &block, vector<double> *jacobian = 0, vector<double> *inputs = 0);
+	void GenerateBlock(vector<vector<TLorentzVector> > &block, ULong64_t firstEvent, vector<double> *jacobian = 0, vector<double> *inputs = 0);
+
+	/*Adaptive proposal: the random inputs of each event, u and W of the e', its phi, then cos(theta) and phi of each 2-body step of the
+	 W decay, are mapped by a VEGAS grid instead of being uniform. The events are then not distributed as phase space anymore,
+	 each one has to be weighted by its jacobian (see GenerateBlock). The grid starts uniform, it is trained by the user of the events
+	 with getProposal().Accumulate() and Adapt(). It must not change while the events of a sample are generated.
+	 With t sampling, the decay is then rotated to the sampled t: the angles of the last step, that orient the whole decay, stay uniform.*/
+	void enableProposal(int nBins) {
+		m_proposal.Init(this->getProposalDim(), nBins);
+		m_useProposal = true;
+		this->fixProposalDims();
+	}
+	void disableProposal() {
+		m_useProposal = false;
+	}
+	bool useProposal() const {
+		return m_useProposal;
+	}
+	int getProposalDim() const {
+		return 3 + 2 * (m_Np - 2);
+	}
+	Clas12PhotonsVegasGrid& getProposal() {
+		return m_proposal;
+	}
+
+	/*t sampling: in the W rest frame, for a given e' and decay configuration, phase space is uniform in t = -(target - recoil)^2,
+	 that is linear in the polar angle of the recoil around the target. With a t distribution set, t is drawn from it between the limits
+	 of the configuration, and the decay is rotated to that angle: the jacobian of the event (see GenerateBlock) then includes the ratio
+	 of the uniform density to the sampled one. The distribution is given in nbins bins (edges and contents), in GeV^2.*/
+	void setTsampling(int nbins, const double *edges, const double *contents) {
+		m_Tsampler.SetDistribution(nbins, edges, contents);
+		m_useTsampling = !m_Tsampler.IsEmpty();
+		this->fixProposalDims();
+	}
+	void disableTsampling() {
+		m_useTsampling = false;
+		this->fixProposalDims();
+	}
+	bool useTsampling() const {
+		return m_useTsampling;
+	}
+
+	ULong64_t getNextEvent() const {
+		return m_nextEvent;
+	}
+
+	void setNextEvent(ULong64_t index) {
+		m_nextEvent = index;
+	}
+
+	int getNumThreads() const {
+		return m_nThreads;
+	}
+
+	void setNumThreads(int n) { //0 means all the cores
+		m_nThreads = n;
+	}
+
 	TLorentzVector GetDecay(int ip) {
 		return m_vP[ip];
 	}
@@ -91,12 +211,15 @@ public:
 
 	 /*Returns in the order required by AmpTools: beam,e',target,other particles*/
 	vector<TLorentzVector> GetAllParticlesAmpToolsOrder(){
-		vector<TLorentzVector> v;
-		v.push_back(m_beam);
-		v.push_back(m_vP[0]);
-		v.push_back(m_target);
-		for (int ip=1;ip<m_Np;ip++) v.push_back(m_vP[ip]);
-		return v;
+		return m_vPAmpTools;
+	}
+
+	//views of the current event, without copies (see Clas12PhotonsEventView): valid until the next event is generated
+	Clas12PhotonsEventView GetEventView() const {
+		return Clas12PhotonsEventView(m_vPAmpTools);
+	}
+	Clas12PhotonsEventView GetFinalStateView() const {
+		return Clas12PhotonsEventView(m_vPAmpTools, true);
 	}
 
 
@@ -104,6 +227,45 @@ public:
 private:
 
 	void computeWdistr();
+	void fillWdistrHisto();
+	//W distribution at the given beam energy: from the cache, or sampled and then cached
+	void getWdistr(double Ebeam, Clas12PhotonsCDFSampler &sampler, Clas12PhotonsPhaseSpace &generator);
+	void sampleWdistr(double Ebeam, Clas12PhotonsCDFSampler &sampler, Clas12PhotonsPhaseSpace &generator);
+	void interpolateWdistr(double E1, const Clas12PhotonsCDFSampler &sampler1, double E2, const Clas12PhotonsCDFSampler &sampler2, double Ebeam, Clas12PhotonsCDFSampler &sampler) const;
+	string WdistrCacheKey(double Ebeam) const;
+	string WdistrCacheFile(double Ebeam) const;
+	bool readWdistr(istream &in, double Ebeam, Clas12PhotonsCDFSampler &sampler, Clas12PhotonsPhaseSpace &generator) const;
+	void writeWdistr(ostream &out, double Ebeam, const Clas12PhotonsCDFSampler &sampler, const Clas12PhotonsPhaseSpace &generator) const;
+	bool readWdistrCache(double Ebeam, Clas12PhotonsCDFSampler &sampler, Clas12PhotonsPhaseSpace &generator) const;
+	void writeWdistrCache(double Ebeam, const Clas12PhotonsCDFSampler &sampler, const Clas12PhotonsPhaseSpace &generator) const;
+
+	//what Generate had to correct, counted by each thread and reported once by reportCounters
+	struct GenerateCounters {
+		long nWmaxClipped; //W upper limit from the e' limits above the physical one
+		long nWminClipped; //W lower limit from the e' limits below the physical one
+		long nOverweight;  //decay weight above the measured max
+		double maxOverweight; //largest weight / max
+
+		GenerateCounters() :
+				nWmaxClipped(0), nWminClipped(0), nOverweight(0), maxOverweight(0) {
+		}
+		void add(const GenerateCounters &other);
+	};
+
+	//thread-safe version of Generate(): all the state that changes is passed as argument. rnd must already be set to the event.
+	//Returns the jacobian of the proposal grid, and its inputs in x if not null
+	double Generate(TRandom *rnd, Clas12PhotonsPhaseSpace &generator, vector<TLorentzVector> &vP, GenerateCounters &counters, double *x = 0) const;
+	void reportCounters(const char *method, const GenerateCounters &counters) const;
+	void fillAmpToolsOrder(const vector<TLorentzVector> &vP, vector<TLorentzVector> &v) const;
+	//draws t for the decay at rest in generator and rotates it accordingly, returns the jacobian
+	double sampleT(TRandom *rnd, Clas12PhotonsPhaseSpace &generator, const Clas12PhotonsFourVector &Pw) const;
+	//when t is sampled, the proposal inputs of the last 2-body step are fixed: they give the orientation of the whole decay at rest,
+	//that RotateRest then changes. The first and only step for a 2-body decay
+	void fixProposalDims() {
+		int nDim = this->getProposalDim();
+		m_proposal.SetFixed(nDim - 2, m_useTsampling);
+		m_proposal.SetFixed(nDim - 1, m_useTsampling);
+	}
 
 	//the reaction
 	ReactionInfo *m_reaction;
@@ -125,7 +287,15 @@ private:
 	double m_EprimeMax;
 
 	//W distribution
-	TH1D* m_Wdistr;
+	TH1D* m_Wdistr; //for monitoring, the generation uses m_Wsampler
+	Clas12PhotonsCDFSampler m_Wsampler;
+	int m_WdistrEvents;
+	int m_WdistrBins;
+	bool m_WdistrAdaptive;
+	string m_WdistrCacheDir;
+	int m_WdistrGridPoints;
+	double m_WdistrGridEmin;
+	double m_WdistrGridEmax;
 
 	double m_Wmax; //the physical maximum value of W
 	double m_Wmin; //the physical minimum value of W
@@ -143,9 +313,19 @@ private:
 	vector<int> m_pid;
 	vector<double> m_pmass;
 	vector<TLorentzVector> m_vP;
+	vector<TLorentzVector> m_vPAmpTools; //the same event in the AmpTools order
 
-	TGenPhaseSpace m_generator;
+	Clas12PhotonsPhaseSpace m_generator; //W decay, copied by each thread
 	double m_generatorMaxWt;
+	Clas12PhotonsRandom m_rnd; //used by the serial methods
+
+	Clas12PhotonsVegasGrid m_proposal;
+	bool m_useProposal;
+	Clas12PhotonsCDFSampler m_Tsampler;
+	bool m_useTsampling;
+
+	int m_nThreads;
+	ULong64_t m_nextEvent; //index of the next PS event
 };
 
 #endif
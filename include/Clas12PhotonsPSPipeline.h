@@ -0,0 +1,55 @@
+#ifndef CLAS12PHOTONSPSPIPELINE
+#define CLAS12PHOTONSPSPIPELINE
+
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <functional>
+
+#include "TLorentzVector.h"
+
+using namespace std;
+
+//one block of PS events, in the AmpTools order, with their PS generator index and proposal jacobian
+typedef struct {
+
+	vector<vector<TLorentzVector> > events;
+	vector<ULong64_t> index;
+	vector<double> jacobian;
+
+} Clas12PhotonsPSBlock;
+
+/* Producer/consumer pipeline of PS blocks: a producer thread fills the blocks while the consumer computes the intensities of the previous ones.
+ The blocks go through a lock-free single producer single consumer ring of depth slots: the producer waits when all of them are full
+ (backpressure, the memory is bounded to depth blocks), the consumer waits when all of them are empty. The blocks are consumed in the order
+ they are produced, so that the result does not depend on the timing of the two threads.
+ Depth 0 has no producer thread: Next() fills the block itself.*/
+class Clas12PhotonsPSPipeline {
+
+public:
+
+	Clas12PhotonsPSPipeline(int depth = 2);
+	~Clas12PhotonsPSPipeline();
+
+	//starts the producer thread, that calls fill(block, n) on each free slot, n counting the blocks from 0
+	void Start(const function<void(Clas12PhotonsPSBlock&, long)> &fill);
+	//the oldest filled block, waiting for it: it is valid until Release()
+	Clas12PhotonsPSBlock& Next();
+	void Release();
+	//stops the producer, the blocks not yet consumed are dropped
+	void Stop();
+
+private:
+
+	void produce();
+
+	int m_depth;
+	vector<Clas12PhotonsPSBlock> m_slots;
+	function<void(Clas12PhotonsPSBlock&, long)> m_fill;
+	std::thread m_producer;
+	std::atomic<long> m_head; //blocks consumed
+	std::atomic<long> m_tail; //blocks produced
+	std::atomic<bool> m_stop;
+};
+
+#endif
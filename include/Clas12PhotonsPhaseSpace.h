@@ -0,0 +1,83 @@
+#ifndef CLAS12PHOTONSPHASESPACE
+#define CLAS12PHOTONSPHASESPACE
+
+#include <vector>
+
+using namespace std;
+
+class TRandom;
+
+//plain four-vector, without the TObject overhead of TLorentzVector
+struct Clas12PhotonsFourVector {
+	double E, px, py, pz;
+};
+
+/* N-body phase space generator, GENBOD algorithm (same as ROOT TGenPhaseSpace), with the random number generator passed
+ to the methods instead of using gRandom: each thread can own an instance together with its own TRandom.
+ The masses are set once. Each event is generated in the rest frame of the parent, given only its mass,
+ and the accepted one is then boosted with Boost(): there is no SetDecay per event.
+ The weight returned by GenerateRest is the product of the 2-body momenta. Instead of the analytic bound of TGenPhaseSpace,
+ the accept/reject uses the max weight measured by ComputeMaxWeight on a grid of parent masses.*/
+
+class Clas12PhotonsPhaseSpace {
+
+public:
+
+	static const int maxParticles = 18;
+
+	Clas12PhotonsPhaseSpace() :
+			m_Nt(0), m_massSum(0), m_maxWeightMmin(0), m_maxWeightStep(0) {
+	}
+
+	bool SetMasses(int nt, const double *mass);
+
+	//measures the max weight for parent masses from Mmin to Mmax, on nGrid points with nSample events each.
+	//The weight grows with the parent mass, so the value used for a mass is the one of the grid point above it, times a safety factor.
+	void ComputeMaxWeight(TRandom *rnd, double Mmin, double Mmax, int nGrid = 64, int nSample = 20000);
+	double GetMaxWeight(double M) const;
+	//the measured table, to save and restore it
+	void GetMaxWeightTable(vector<double> &table, double &Mmin, double &step) const {
+		table = m_maxWeight;
+		Mmin = m_maxWeightMmin;
+		step = m_maxWeightStep;
+	}
+	void SetMaxWeightTable(const vector<double> &table, double Mmin, double step) {
+		m_maxWeight = table;
+		m_maxWeightMmin = Mmin;
+		m_maxWeightStep = step;
+	}
+
+	//decay of a parent of mass M at rest. Returns the weight, 0 if M is below threshold.
+	//The weight does not depend on the angles: if given, angles has the 2 (nt - 1) uniform numbers for cos(theta) and phi of each step
+	double GenerateRest(TRandom *rnd, double M, const double *angles = 0);
+	//rotates the last event (still at rest) so that particle n makes the angle acos(cosTheta) with the direction of a, keeping its azimuth
+	void RotateRest(int n, const Clas12PhotonsFourVector &a, double cosTheta);
+	//boosts the last event to the frame where the parent has 4-momentum P
+	void Boost(const Clas12PhotonsFourVector &P);
+
+	const Clas12PhotonsFourVector& GetDecay(int n) const {
+		return m_DecPro[n];
+	}
+	int GetNt() const {
+		return m_Nt;
+	}
+	double GetMassSum() const {
+		return m_massSum;
+	}
+
+private:
+
+	static double PDK(double a, double b, double c);
+
+	int m_Nt;                     //number of decay particles
+	double m_Mass[maxParticles];  //masses of particles
+	double m_massSum;
+	Clas12PhotonsFourVector m_DecPro[maxParticles]; //4-momenta of the decay products
+
+	//measured max weight, on a grid of parent masses
+	vector<double> m_maxWeight;
+	double m_maxWeightMmin;
+	double m_maxWeightStep;
+};
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef CLAS12PHOTONSRANDOM
+#define CLAS12PHOTONSRANDOM
+
+#include "TRandom.h"
+
+/* Counter-based random generator (Philox4x32-10, Salmon et al., SC11).
+ The numbers are not a sequence: each one is a function of (seed, stream, event index, draw number), so any event can be
+ reproduced alone, and the sample does not depend on how the events are split between threads or farm jobs.
+ The stream identifies the stage of the generation (see Streams), optionally with an iteration number.
+ SetEvent() selects the event and restarts its draws from 0; Rndm() then returns the draws of that event one after the other.
+ Since it is a TRandom, it can be passed wherever one is used (Uniform, Gaus, ... are built on Rndm).*/
+
+class Clas12PhotonsRandom: public TRandom {
+
+public:
+
+	enum Streams {
+		kPhaseSpace = 1, //the PS events
+		kWdistr,         //the W-distribution sampling
+		kTweight,        //reserved, unused: the t-weight filter on the PS events, now t is sampled. Kept so the other streams are not renumbered
+		kEfficiency,     //the hit-or-miss in the efficiency computation
+		kHitOrMiss,      //the hit-or-miss in the event generation
+		kMaxWeight,      //the measurement of the phase-space max weight
+		kThinning        //the thinning of the accepted events when the max intensity goes up
+	};
+
+	Clas12PhotonsRandom(ULong64_t seed = 0, UInt_t stream = 0);
+	virtual ~Clas12PhotonsRandom() {
+	}
+
+	//iteration goes in the low 24 bits of the stream word, so that each iteration of a stage has its own numbers
+	void SetStream(UInt_t stream, UInt_t iteration = 0) {
+		m_stream = (stream << 24) | (iteration & 0xFFFFFF);
+		m_draw = 0;
+		m_nBuffered = 0;
+	}
+
+	void SetEvent(ULong64_t event) {
+		m_event = event;
+		m_draw = 0;
+		m_nBuffered = 0;
+	}
+
+	ULong64_t GetEvent() const {
+		return m_event;
+	}
+
+	virtual void SetSeed(ULong_t seed = 0);
+	virtual UInt_t GetSeed() const {
+		return m_key[0];
+	}
+
+	//uniform on 52 bits, the 2^52 centers of the bins of width 2^-52: from 2^-53 to 1 - 2^-53, never 0 or 1
+	virtual Double_t Rndm();
+	virtual void RndmArray(Int_t n, Float_t *array);
+	virtual void RndmArray(Int_t n, Double_t *array);
+
+	//the bare Philox4x32-10 bijection
+	static void Philox(const UInt_t *counter, const UInt_t *key, UInt_t *out);
+
+private:
+
+	UInt_t m_key[2];
+	UInt_t m_stream;
+	ULong64_t m_event;
+	UInt_t m_draw;       //Philox blocks used so far for this event
+	UInt_t m_buffer[4];  //the last block, two doubles
+	int m_nBuffered;
+};
+
+#endif
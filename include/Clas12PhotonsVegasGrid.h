@@ -0,0 +1,71 @@
+#ifndef CLAS12PHOTONSVEGASGRID
+#define CLAS12PHOTONSVEGASGRID
+
+#include <vector>
+
+using namespace std;
+
+/* Factorized adaptive grid (VEGAS, G.P. Lepage, J. Comput. Phys. 27 (1978) 192) on the unit hypercube.
+ Each dimension has nbins bins of variable width, each one with probability 1/nbins: Map() takes a point uniform in the hypercube
+ to one that is dense where the bins are narrow, and returns the jacobian, the inverse of the density of the new point.
+ The grid learns a function f: Accumulate() adds f times the jacobian of each point, Adapt() moves the edges so that each bin gets
+ the same share of it in every dimension. The density then follows the projections of f, and f times the jacobian is flatter.*/
+
+class Clas12PhotonsVegasGrid {
+
+public:
+
+	Clas12PhotonsVegasGrid() :
+			m_ndim(0), m_nbins(0), m_alpha(1.5) {
+	}
+
+	//uniform grid
+	void Init(int ndim, int nbins);
+
+	//y uniform in [0,1)^ndim, returns the jacobian dx/dy
+	double Map(const double *y, double *x) const;
+
+	//f is the function at x times the jacobian of x
+	void Accumulate(const double *x, double f);
+	//new edges from the accumulated values, that are then reset
+	void Adapt();
+
+	//a fixed dimension stays uniform: Map() leaves it unchanged, Accumulate() and Adapt() skip it. Init() frees all of them
+	void SetFixed(int idim, bool fixed) {
+		if (idim >= 0 && idim < m_ndim) m_fixed[idim] = fixed;
+	}
+	bool IsFixed(int idim) const {
+		return m_fixed[idim];
+	}
+
+	//damping of the adaptation, 0 does not change the grid, the larger the faster it moves
+	void SetDamping(double alpha) {
+		m_alpha = alpha;
+	}
+
+	int GetNdim() const {
+		return m_ndim;
+	}
+	int GetNbins() const {
+		return m_nbins;
+	}
+	bool IsEmpty() const {
+		return m_ndim == 0;
+	}
+	//ndim x (nbins + 1) edges, to save and restore the grid
+	const vector<double>& GetEdges() const {
+		return m_edges;
+	}
+	bool SetEdges(int ndim, int nbins, const vector<double> &edges);
+
+private:
+
+	int m_ndim;
+	int m_nbins;
+	double m_alpha;
+	vector<double> m_edges; //ndim x (nbins + 1)
+	vector<double> m_sum;   //ndim x nbins
+	vector<bool> m_fixed;   //ndim
+};
+
+#endif
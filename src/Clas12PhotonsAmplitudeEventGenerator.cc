@@ -1,7 +1,15 @@
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cmath>
 
 #include "Clas12PhotonsAmplitudeEventGenerator.h"
 #include "Clas12PhotonsPSEventGenerator.h"
+#include "Clas12PhotonsEventSink.h"
+#include "Clas12PhotonsPSPipeline.h"
+
+#include "IUAmpTools/Kinematics.h"
 
 #include "IUAmpTools/ConfigurationInfo.h"
 #include "IUAmpTools/ConfigFileParser.h"
@@ -13,7 +21,7 @@
 #include "TCanvas.h"
 
 Clas12PhotonsAmplitudeEventGenerator::Clas12PhotonsAmplitudeEventGenerator(const string &cfgfile, int Nevents) :
-		m_dbPDG(0), m_Ebeam(11.), m_seed(0), m_Np(0), m_reaction(0), m_GenerationDone(false), m_Nevents(Nevents), m_ATI(0), m_hTweight(0) {
+		m_dbPDG(0), m_reaction(0), m_ATI(0), m_Nevents(Nevents), m_seed(0), m_cfgfile(cfgfile), m_maxIntensity(0), m_Ebeam(11.), m_GenerationDone(false), m_hTweight(0), m_Np(0) {
 	//init the DB
 	m_dbPDG = TDatabasePDG::Instance();
 	if (m_dbPDG == 0) {
@@ -35,17 +43,39 @@ Clas12PhotonsAmplitudeEventGenerator::Clas12PhotonsAmplitudeEventGenerator(const
 	m_ATI = new AmpToolsInterface(cfgInfo);
 
 	m_doTweight = false;
+	m_TweightDone = false;
 	m_Nt = 1E6;
 
 	m_EfficiencyDone = false;
 	m_efficiency = 0;
 
 	m_savedMin = 100;
+	m_efficiencyPrecision = 0.01;
 	m_safetyFactor = 2;
 
 	m_Np = m_PSgenerator->getNp();
+	m_generated.Init(m_Np + 2);
+
+	m_storeEvents = true;
+	m_lastEvent = -1;
+
+	m_PSblockSize = 100000;
+	m_pipelineDepth = 2;
+	m_streamMaxFactor = 1.2;
+	m_nOverweight = 0;
+
+	m_proposalIterations = 0;
+	m_proposalEvents = 0;
+	m_proposalBins = 50;
+	m_proposalDone = false;
+
+	m_weighted = false;
+	m_weightSum = 0;
+	m_weight2Sum = 0;
+	m_weightMax = 0;
 
 	gRandom->SetSeed(m_seed);
+	m_rnd.SetSeed((ULong64_t) m_seed);
 }
 
 Clas12PhotonsAmplitudeEventGenerator::~Clas12PhotonsAmplitudeEventGenerator() {
@@ -54,6 +84,13 @@ Clas12PhotonsAmplitudeEventGenerator::~Clas12PhotonsAmplitudeEventGenerator() {
 	if (m_hTweight) delete m_hTweight;
 }
 
+void Clas12PhotonsAmplitudeEventGenerator::setSeed(double seed) {
+	m_seed = seed;
+	gRandom->SetSeed(m_seed);
+	m_rnd.SetSeed((ULong64_t) m_seed);
+	m_PSgenerator->setSeed(seed);
+}
+
 void Clas12PhotonsAmplitudeEventGenerator::setEbeam(double ebeam) {
 	double s;
 	double M;
@@ -65,10 +102,15 @@ void Clas12PhotonsAmplitudeEventGenerator::setEbeam(double ebeam) {
 	if (m_doTweight) {
 		if (m_hTweight != 0) delete m_hTweight;
 		m_hTweight = new TH1D("m_hTweight", "m_hTweight", 1000, 0, s);
+		m_PSgenerator->disableTsampling(); //until computeTweight
 	}
 
+	m_TweightDone = false;
 	m_EfficiencyDone = false;
 	m_GenerationDone = false;
+	m_proposalDone = false;
+	m_effIndex.clear();
+	m_effIntensity.clear();
 }
 
 void Clas12PhotonsAmplitudeEventGenerator::EnableTweight() {
@@ -81,10 +123,17 @@ void Clas12PhotonsAmplitudeEventGenerator::EnableTweight() {
 	m_hTweight = new TH1D("m_hTweight", "m_hTweight", 1000, 0, s);
 
 	m_doTweight = true;
+	m_TweightDone = false;
+	m_PSgenerator->disableTsampling(); //until computeTweight
 }
 
 void Clas12PhotonsAmplitudeEventGenerator::DisableTweight() {
 	m_doTweight = false;
+	m_PSgenerator->disableTsampling();
+}
+
+void Clas12PhotonsAmplitudeEventGenerator::setNumThreads(int n) {
+	m_PSgenerator->setNumThreads(n);
 }
 
 void Clas12PhotonsAmplitudeEventGenerator::GenerateEvents(int Nevents) {
@@ -94,84 +143,379 @@ void Clas12PhotonsAmplitudeEventGenerator::GenerateEvents(int Nevents) {
 
 void Clas12PhotonsAmplitudeEventGenerator::GenerateEvents() {
 	int N_PS;
-	int it_generation;
-	int saved;
-
-	double t, wt;
-	double intensity, maxIntensity,maxIntensityThis;
+	int it_generation, nThinning;
+	int saved, missing;
+	long nGenerated;
+
+	double rate;
+	double intensity, maxIntensity, maxIntensityThis;
+	ULong64_t nextEvent;
+	Clas12PhotonsPSPipeline pipeline(m_pipelineDepth);
+
+	if (m_weighted) {
+		this->generateWeightedEvents();
+		return;
+	}
 
 	if (!m_EfficiencyDone) this->computeEfficiency();
 
-	N_PS = int(m_Nevents * m_safetyFactor / m_efficiency);
-	it_generation = 1;
-	cout << " Will start generating " << N_PS << " PS events" << endl;
-	m_kinVPS.clear();
-	m_kinVGenerated.clear();
-
+	m_generated.Init(m_Np + 2);
+	m_generatedIndex.clear();
+	m_generatedWeight.clear();
+	m_lastEvent = -1;
+
+	/*Incremental unweighting: each PS event gets its hit-or-miss only once, against the max intensity seen so far.
+	 If a later block has a larger max, the events already accepted are thinned by the ratio of the two maxima,
+	 so that all of them end up accepted with probability intensity / max. AmpTools holds one block at a time.*/
+	maxIntensity = m_maxIntensity;
+	saved = 0;
+	nGenerated = 0;
+	nThinning = 0;
+
+	//the events of the efficiency computation come first: their intensities are known, only the accepted ones are generated again
+	if (!m_effIndex.empty()) {
+		Info("GenerateEvents", "Using the %i PS events of the efficiency computation", (int) m_effIndex.size());
+		m_rnd.SetStream(Clas12PhotonsRandom::kHitOrMiss);
+		for (unsigned int i = 0; i < m_effIndex.size(); i++) {
+			m_rnd.SetEvent(m_effIndex[i]);
+			if (m_effIntensity[i] > m_rnd.Uniform(0, maxIntensity)) {
+				m_PSgenerator->GenerateEvent(m_effIndex[i]);
+				this->addGeneratedEvent(m_PSgenerator->GetEventView().GetAmpToolsOrder(), m_effIndex[i], m_effIntensity[i]);
+				saved++;
+			}
+		}
+		nGenerated = m_effIndex.size();
+		vector<ULong64_t>().swap(m_effIndex); //used once
+		vector<double>().swap(m_effIntensity);
+		cout << " PS events: " << nGenerated << " accepted: " << saved << endl;
+	}
 
+	//from here on the PS blocks come from the producer thread. A batch is made of whole blocks
+	nextEvent = m_PSgenerator->getNextEvent();
+	if (saved < m_Nevents) this->startPSPipeline(pipeline);
+	it_generation = 0;
+	while (saved < m_Nevents) {
+		if (nGenerated == 0) {
+			N_PS = int(m_Nevents * m_safetyFactor / m_efficiency);
+		} else {
+			//next batch from the acceptance measured so far, with a 3 sigma margin on the missing events
+			missing = m_Nevents - saved;
+			if (saved > 0) {
+				rate = (double) saved / nGenerated;
+				N_PS = int((missing + 3 * sqrt(missing) + 1) / rate);
+			} else {
+				N_PS = 10 * nGenerated;
+			}
+			Info("GenerateEvents", "NOT enough events were generated: only %i out of %i", saved, m_Nevents);
+		}
+		it_generation++;
+		Info("GenerateEvents", "Generation iteration %i : %i PS events", it_generation, N_PS);
+
+		for (int iFirst = 0; iFirst < N_PS; iFirst += m_PSblockSize) {
+			Clas12PhotonsPSBlock &PSblock = pipeline.Next();
+			const vector<vector<TLorentzVector> > &block = PSblock.events;
+			vector<double> &jacobian = PSblock.jacobian;
+			m_ATI->clearEvents();
+			for (int i = 0; i < (int) block.size(); i++) {
+				Kinematics m_kin(block[i]);
+				m_ATI->loadEvent(&m_kin, i, block.size());
+			}
+			m_ATI->processEvents(m_reaction->reactionName());
+			maxIntensityThis = 0;
+			for (int i = 0; i < (int) block.size(); i++) {
+				jacobian[i] *= m_ATI->intensity(i); //intensity relative to the proposal
+				if (jacobian[i] > maxIntensityThis) maxIntensityThis = jacobian[i];
+			}
+			if (maxIntensityThis > maxIntensity) {
+				if (saved > 0) {
+					nThinning++;
+					saved = this->thinGeneratedEvents(maxIntensity / maxIntensityThis, nThinning);
+					Info("GenerateEvents", "Max intensity went up from %f to %f, %i accepted events left", maxIntensity, maxIntensityThis, saved);
+				}
+				maxIntensity = maxIntensityThis;
+			}
 
-	maxIntensity=0;
-	m_intensities.clear();
-	while (1) {
-		Info("GenerateEvents", "Generation iteration %i : generate PS events", it_generation);
-		m_ATI->clearEvents();
-		for (int i = 0; i < N_PS; i++) {
-			m_PSgenerator->Generate();
-			if (m_doTweight) {
-				t = -(m_PSgenerator->GetAllParticlesAmpToolsOrder()[2] - m_PSgenerator->GetAllParticlesAmpToolsOrder()[3]).M2();
-				wt = m_hTweight->GetBinContent(m_hTweight->FindBin(t));
-				if (wt < gRandom->Uniform(0, m_wtMax)) {
-					i--;
-					continue;
+			m_rnd.SetStream(Clas12PhotonsRandom::kHitOrMiss);
+			for (int i = 0; i < (int) block.size(); i++) {
+				intensity = jacobian[i];
+				m_rnd.SetEvent(PSblock.index[i]); //the draw follows the PS event
+				if (intensity > m_rnd.Uniform(0, maxIntensity)) {  //if intensity is bigger than random number between 0 and max, keep it.
+					this->addGeneratedEvent(block[i], PSblock.index[i], intensity);
+					saved++;
 				}
 			}
-			if (i % (N_PS / 10) == 0) cout << " PS event: " << i << endl;
-			Kinematics m_kin(m_PSgenerator->GetAllParticlesAmpToolsOrder());
-			m_kinVPS.push_back(m_kin); //save the event also in this vector, for later use if this loop is entered again
-			m_ATI->loadEvent(&m_kin, (it_generation - 1) * N_PS+i, N_PS * it_generation);
-		}
-		Info("GenerateEvents", "Generation iteration %i : computing intensity ", it_generation);
-		maxIntensityThis = m_ATI->processEvents(m_reaction->reactionName());
-		for (int i=0 ; i < N_PS ; i++){
-			m_intensities.push_back(m_ATI->intensity(i));
+			nGenerated += block.size();
+			nextEvent = PSblock.index.back() + 1;
+			pipeline.Release();
+			cout << " PS events: " << nGenerated << " accepted: " << saved << endl;
 		}
-
-		if (maxIntensityThis>maxIntensity) maxIntensity=maxIntensityThis;
 		Info("GenerateEvents", "Done. Max Intensity is: %f", maxIntensity);
-		Info("GenerateEvents", "Doing hit-or-miss");
+	}
+	this->stopPSPipeline(pipeline, nextEvent);
+	Info("GenerateEvents", "Enough events were generated in iteration: %i", it_generation);
+	m_GenerationDone = true;
+}
 
-		saved = 0;
-		m_kinVGenerated.clear();
+double Clas12PhotonsAmplitudeEventGenerator::getTweight(const vector<TLorentzVector> &vP) const {
+	double t;
 
-		for (int i = 0; i < N_PS*it_generation; i++) {
-			if ((i % 10000) == 0) cout << "Event " << i << " intensity: " <<m_intensities[i]<< endl;
-			intensity = m_intensities[i];
-			if (intensity > gRandom->Uniform(0, maxIntensity)) {  //if intensity is bigger than random number between 0 and max, keep it.
-				saved++;
-				if (m_doTweight) {
-					t = -(m_ATI->kinematics(i)->particleList()[2] - m_ATI->kinematics(i)->particleList()[3]).M2(); //A.C. definitively need to do this better
-					wt = m_hTweight->GetBinContent(m_hTweight->FindBin(t));
-				}
-				else{
-					wt=1;
-				}
-				m_kinVPS[i].setWeight(wt);
-				m_kinVGenerated.push_back(m_kinVPS[i]);
+	if (!m_doTweight) return 1;
+	t = -(vP[2] - vP[3]).M2();
+	return m_hTweight->GetBinContent(m_hTweight->FindBin(t));
+}
+
+void Clas12PhotonsAmplitudeEventGenerator::addGeneratedEvent(const vector<TLorentzVector> &vP, ULong64_t index, double intensity) {
+	double wt = this->getTweight(vP);
+
+	if (m_storeEvents) {
+		m_generated.Append(vP, wt, intensity);
+	} else {
+		m_generatedIndex.push_back(index);
+		m_generatedWeight.push_back(wt);
+	}
+}
+
+int Clas12PhotonsAmplitudeEventGenerator::thinGeneratedEvents(double keep, int iteration) {
+	int n = 0;
+
+	m_rnd.SetStream(Clas12PhotonsRandom::kThinning, iteration);
+	if (m_storeEvents) {
+		for (long i = 0; i < m_generated.Size(); i++) {
+			m_rnd.SetEvent(i);
+			m_generated.SetAccept(i, m_rnd.Rndm() < keep);
+		}
+		n = m_generated.Compact();
+	} else {
+		for (unsigned int i = 0; i < m_generatedIndex.size(); i++) {
+			m_rnd.SetEvent(i);
+			if (m_rnd.Rndm() >= keep) continue;
+			m_generatedIndex[n] = m_generatedIndex[i];
+			m_generatedWeight[n] = m_generatedWeight[i];
+			n++;
+		}
+		m_generatedIndex.resize(n);
+		m_generatedWeight.resize(n);
+	}
+	m_lastEvent = -1;
+	return n;
+}
+
+void Clas12PhotonsAmplitudeEventGenerator::GenerateEvents(Clas12PhotonsEventSink &sink) {
+	int written = 0;
+	long nGenerated = 0;
+	bool stop = false;
+	double intensity, maxIntensity, weight;
+	ULong64_t nextEvent;
+	Clas12PhotonsPSPipeline pipeline(m_pipelineDepth);
+
+	if (m_weighted) {
+		if (m_doTweight && !m_TweightDone) this->computeTweight();
+		if (m_proposalIterations > 0 && !m_proposalDone) this->trainProposal();
+	} else if (!m_EfficiencyDone) {
+		this->computeEfficiency();
+	}
+
+	maxIntensity = m_maxIntensity * m_streamMaxFactor;
+	m_nOverweight = 0;
+	m_weightSum = 0;
+	m_weight2Sum = 0;
+	m_weightMax = 0;
+	Info("GenerateEvents", "Streaming generation of %i events, max intensity %f", m_Nevents, maxIntensity);
+	sink.begin(m_Nevents);
+
+	//the events of the efficiency computation come first, as in GenerateEvents()
+	m_rnd.SetStream(Clas12PhotonsRandom::kHitOrMiss);
+	for (unsigned int i = 0; i < m_effIndex.size() && written < m_Nevents && !m_weighted && !stop; i++) {
+		m_rnd.SetEvent(m_effIndex[i]);
+		if (m_effIntensity[i] > m_rnd.Uniform(0, maxIntensity)) {
+			m_PSgenerator->GenerateEvent(m_effIndex[i]);
+			const vector<TLorentzVector> &event = m_PSgenerator->GetEventView().GetAmpToolsOrder();
+			weight = this->getTweight(event);
+			if (m_effIntensity[i] > maxIntensity) {
+				weight *= m_effIntensity[i] / maxIntensity;
+				m_nOverweight++;
 			}
-			else{
-				m_kinVPS[i].setWeight(1.); //for later safety
+			stop = !sink.writeEvent(event, weight);
+			written++;
+		}
+	}
+	if (!m_weighted) nGenerated = m_effIndex.size();
+	vector<ULong64_t>().swap(m_effIndex);
+	vector<double>().swap(m_effIntensity);
+
+	nextEvent = m_PSgenerator->getNextEvent();
+	if (written < m_Nevents && !stop) this->startPSPipeline(pipeline);
+	while (written < m_Nevents && !stop) {
+		Clas12PhotonsPSBlock &PSblock = pipeline.Next();
+		const vector<vector<TLorentzVector> > &block = PSblock.events;
+		int n = block.size();
+		if (m_weighted) n = min(n, m_Nevents - written); //exactly m_Nevents PS events
+		m_ATI->clearEvents();
+		for (int i = 0; i < n; i++) {
+			Kinematics m_kin(block[i]);
+			m_ATI->loadEvent(&m_kin, i, n);
+		}
+		m_ATI->processEvents(m_reaction->reactionName());
+
+		m_rnd.SetStream(Clas12PhotonsRandom::kHitOrMiss);
+		for (int i = 0; i < n && written < m_Nevents && !stop; i++) {
+			intensity = m_ATI->intensity(i) * PSblock.jacobian[i]; //intensity relative to the proposal
+			if (m_weighted) {
+				weight = intensity; //the jacobian already includes the t-weight
+				m_weightSum += weight;
+				m_weight2Sum += weight * weight;
+				if (weight > m_weightMax) m_weightMax = weight;
+			} else {
+				m_rnd.SetEvent(PSblock.index[i]); //the draw follows the PS event
+				if (intensity <= m_rnd.Uniform(0, maxIntensity)) continue;
+				weight = this->getTweight(block[i]);
+				if (intensity > maxIntensity) {
+					weight *= intensity / maxIntensity;
+					m_nOverweight++;
+				}
 			}
+			stop = !sink.writeEvent(block[i], weight);
+			written++;
 		}
-		if (saved >= m_Nevents) {
-			Info("GenerateEvents", "Enough events were generated in iteration: %i", it_generation);
-			m_GenerationDone = true;
-			break;
-		} else {
-			Info("GenerateEvents", "NOT enough events were generated in iteration: %i, only %i out of %i. Repeat", it_generation, saved, m_Nevents);
-			it_generation++;
+		nGenerated += n;
+		nextEvent = PSblock.index[n - 1] + 1;
+		pipeline.Release();
+		cout << " PS events: " << nGenerated << " written: " << written << endl;
+	}
+	this->stopPSPipeline(pipeline, nextEvent);
+	sink.end();
+
+	Info("GenerateEvents", "Done: %i events written from %li PS events", written, nGenerated);
+	if (m_nOverweight > 0) Warning("GenerateEvents", "%li events above the max intensity, written with weight intensity / max. Increase the streaming max factor", m_nOverweight);
+}
+
+void Clas12PhotonsAmplitudeEventGenerator::generateWeightedEvents() {
+	double weight, norm;
+	int n;
+	ULong64_t nextEvent;
+	Clas12PhotonsPSPipeline pipeline(m_pipelineDepth);
+
+	if (m_doTweight && !m_TweightDone) this->computeTweight();
+	if (m_proposalIterations > 0 && !m_proposalDone) this->trainProposal();
+
+	Info("GenerateEvents", "Weighted generation of %i events", m_Nevents);
+	m_generated.Init(m_Np + 2);
+	m_generatedIndex.clear();
+	m_generatedWeight.clear();
+	m_lastEvent = -1;
+	m_weightSum = 0;
+	m_weight2Sum = 0;
+	m_weightMax = 0;
+
+	//the intensity is computed block by block, so that AmpTools only holds one block, while the next ones are generated
+	nextEvent = m_PSgenerator->getNextEvent();
+	if (m_Nevents > 0) this->startPSPipeline(pipeline);
+	for (int iFirst = 0; iFirst < m_Nevents; iFirst += m_PSblockSize) {
+		Clas12PhotonsPSBlock &PSblock = pipeline.Next();
+		const vector<vector<TLorentzVector> > &block = PSblock.events;
+		n = min(m_PSblockSize, m_Nevents - iFirst);
+		m_ATI->clearEvents();
+		for (int i = 0; i < n; i++) {
+			Kinematics m_kin(block[i]);
+			m_ATI->loadEvent(&m_kin, i, n);
 		}
+		m_ATI->processEvents(m_reaction->reactionName());
+		for (int i = 0; i < n; i++) {
+			weight = m_ATI->intensity(i) * PSblock.jacobian[i]; //the jacobian already includes the t-weight
+			m_weightSum += weight;
+			m_weight2Sum += weight * weight;
+			if (weight > m_weightMax) m_weightMax = weight;
+			if (m_storeEvents) {
+				m_generated.Append(block[i], weight, weight);
+			} else {
+				m_generatedIndex.push_back(PSblock.index[i]);
+				m_generatedWeight.push_back(weight);
+			}
+		}
+		nextEvent = PSblock.index[n - 1] + 1;
+		pipeline.Release();
+		cout << " Weighted events: " << iFirst + n << endl;
+	}
+	this->stopPSPipeline(pipeline, nextEvent);
+
+	//normalize to average 1
+	norm = (m_weightSum > 0) ? m_Nevents / m_weightSum : 0;
+	m_generated.ScaleWeights(norm);
+	for (unsigned int i = 0; i < m_generatedWeight.size(); i++)
+		m_generatedWeight[i] *= norm;
+
+	Info("GenerateEvents", "Done. Sum of weights %g, max weight %g, effective events %g", m_weightSum, m_weightMax, this->GetEffectiveEvents());
+	m_GenerationDone = true;
+}
+
+bool Clas12PhotonsAmplitudeEventGenerator::writeWeightSummary(const string &fname) const {
+	ofstream file(fname.c_str());
 
+	if (!file.good()) {
+		Error("writeWeightSummary", "Can't write %s", fname.c_str());
+		return false;
 	}
+	file << setprecision(10);
+	file << "#weighted sample: the LUND weights are w / <w>, with w the raw weights below" << "\n";
+	file << "events " << m_Nevents << "\n";
+	file << "sum_w " << m_weightSum << "\n";
+	file << "sum_w2 " << m_weight2Sum << "\n";
+	file << "mean_w " << ((m_Nevents > 0) ? m_weightSum / m_Nevents : 0) << "\n";
+	file << "max_w " << m_weightMax << "\n";
+	file << "effective_events " << this->GetEffectiveEvents() << "\n";
+	file << "Ebeam " << m_PSgenerator->getEbeam() << "\n";
+	file.close();
+	return !file.fail();
+}
+
+void Clas12PhotonsAmplitudeEventGenerator::generatePSEvents(int N, vector<vector<TLorentzVector> > &events, vector<ULong64_t> *indices, vector<double> *jacobians, vector<double> *inputs) {
+	ULong64_t firstEvent = m_PSgenerator->getNextEvent();
+
+	m_PSgenerator->setNextEvent(firstEvent + N);
+	this->generatePSEvents(N, firstEvent, events, indices, jacobians, inputs);
+}
+
+void Clas12PhotonsAmplitudeEventGenerator::generatePSEvents(int N, ULong64_t firstEvent, vector<vector<TLorentzVector> > &events, vector<ULong64_t> *indices, vector<double> *jacobians, vector<double> *inputs) {
+	vector<double> jacobian;
+
+	events.resize(N);
+	if (jacobians == 0) jacobians = &jacobian;
+	m_PSgenerator->GenerateBlock(events, firstEvent, jacobians, inputs);
+	for (int i = 0; i < N; i++) {
+		if (indices) indices->push_back(firstEvent + i);
+		//t was sampled from the t-weight (see setTsampling) and the jacobian brings the events back to phase space:
+		//the target is phase space times the t-weight, as it was with the rejection on the t-weight
+		(*jacobians)[i] *= this->getTweight(events[i]);
+	}
+}
+
+void Clas12PhotonsAmplitudeEventGenerator::startPSPipeline(Clas12PhotonsPSPipeline &pipeline) {
+	ULong64_t firstEvent = m_PSgenerator->getNextEvent();
+	int N = m_PSblockSize;
+
+	//block n has the PS events from firstEvent + n * N on, whatever the timing of the consumer
+	pipeline.Start([this, firstEvent, N](Clas12PhotonsPSBlock &block, long n) {
+		block.index.clear();
+		this->generatePSEvents(N, firstEvent + (ULong64_t) n * N, block.events, &block.index, &block.jacobian);
+	});
+}
+
+void Clas12PhotonsAmplitudeEventGenerator::stopPSPipeline(Clas12PhotonsPSPipeline &pipeline, ULong64_t nextEvent) {
+	pipeline.Stop();
+	m_PSgenerator->setNextEvent(nextEvent);
+}
+
+void Clas12PhotonsAmplitudeEventGenerator::setTsampling() {
+	int nbins = m_hTweight->GetNbinsX();
+	double xmin = m_hTweight->GetXaxis()->GetXmin();
+	double xmax = m_hTweight->GetXaxis()->GetXmax();
+	vector<double> edges(nbins + 1), contents(nbins);
+
+	for (int ibin = 0; ibin <= nbins; ibin++)
+		edges[ibin] = xmin + (xmax - xmin) * ibin / nbins;
+	for (int ibin = 0; ibin < nbins; ibin++)
+		contents[ibin] = max(m_hTweight->GetBinContent(ibin + 1), 0.);
+	m_PSgenerator->setTsampling(nbins, &(edges[0]), &(contents[0]));
 }
 
 double Clas12PhotonsAmplitudeEventGenerator::GetEfficiency() {
@@ -182,81 +526,315 @@ double Clas12PhotonsAmplitudeEventGenerator::GetEfficiency() {
 	return m_efficiency;
 }
 
-void Clas12PhotonsAmplitudeEventGenerator::computeEfficiency() {
-	int it_efficiency = 0;
-	int saved;
-	int N_PS;
-	double intensity, maxIntensity;
+void Clas12PhotonsAmplitudeEventGenerator::computeTweight() {
+	double t, intensity;
+	vector<vector<TLorentzVector> > block;
+	vector<double> jacobian, blockJacobian;
+
+	Info("computeTweight", "doing pre-calculation with t-weight from amplitude");
+	m_ATI->clearEvents();
+	jacobian.clear();
+	for (int iFirst = 0; iFirst < m_Nt; iFirst += m_PSblockSize) {
+		block.resize(min(m_PSblockSize, m_Nt - iFirst));
+		m_PSgenerator->GenerateBlock(block, &blockJacobian);
+		jacobian.insert(jacobian.end(), blockJacobian.begin(), blockJacobian.end());
+		for (int i = iFirst; i < iFirst + (int) block.size(); i++) {
+			Kinematics m_kin(block[i - iFirst]);
+			m_ATI->loadEvent(&m_kin, i, m_Nt);
+		}
+	}
+	m_ATI->processEvents(m_reaction->reactionName());
+	for (int i = 0; i < m_Nt; i++) {
+		t = -(m_ATI->kinematics(i)->particleList()[2] - m_ATI->kinematics(i)->particleList()[3]).M2(); //A.C. definitively need to do this better, but the order should be BEAM 'TARGET RECOIL
+		intensity = m_ATI->intensity(i) * jacobian[i]; //phase space, also with the proposal grid
+		m_hTweight->Fill(t, intensity);
+	}
+	m_hTweight->Scale(1. / m_Nt);
+	m_wtMax = m_hTweight->GetMaximum();
+	m_TweightDone = true;
+	this->setTsampling();
+	Info("computeTweight", "done");
+}
 
-	double t, wt;
+void Clas12PhotonsAmplitudeEventGenerator::setAdaptiveProposal(int nIterations, int nEvents, int nBins) {
+	m_proposalIterations = nIterations;
+	m_proposalEvents = nEvents;
+	m_proposalBins = nBins;
+	m_proposalDone = false;
+	m_EfficiencyDone = false;
+	m_effIndex.clear();
+	m_effIntensity.clear();
+	if (nIterations <= 0) m_PSgenerator->disableProposal();
+}
 
-	if (m_doTweight) {
-		Info("computeEfficiency", "doing pre-calculation with t-weight from amplitude");
-		m_ATI->clearEvents();
-		for (int i = 0; i < m_Nt; i++) {
-			m_PSgenerator->Generate();
-			Kinematics m_kin(m_PSgenerator->GetAllParticlesAmpToolsOrder());
-			m_ATI->loadEvent(&m_kin, i, m_Nt);
+void Clas12PhotonsAmplitudeEventGenerator::trainProposal() {
+	double w, wSum, wMax, eff, bestEff;
+	int nDim;
+	vector<vector<TLorentzVector> > block;
+	vector<double> inputs;
+
+	m_PSgenerator->enableProposal(m_proposalBins);
+	Clas12PhotonsVegasGrid &grid = m_PSgenerator->getProposal();
+	Clas12PhotonsVegasGrid bestGrid(grid);
+	nDim = grid.GetNdim();
+	bestEff = 0;
+	for (int it = 0; it < m_proposalIterations; it++) {
+		wSum = 0;
+		wMax = 0;
+		for (int iFirst = 0; iFirst < m_proposalEvents; iFirst += m_PSblockSize) {
+			this->generatePSEvents(min(m_PSblockSize, m_proposalEvents - iFirst), block, 0, &m_PSjacobian, &inputs);
+			m_ATI->clearEvents();
+			for (int i = 0; i < (int) block.size(); i++) {
+				Kinematics m_kin(block[i]);
+				m_ATI->loadEvent(&m_kin, i, block.size());
+			}
+			m_ATI->processEvents(m_reaction->reactionName());
+			for (int i = 0; i < (int) block.size(); i++) {
+				w = m_ATI->intensity(i) * m_PSjacobian[i];
+				grid.Accumulate(&(inputs[(long) i * nDim]), w);
+				wSum += w;
+				if (w > wMax) wMax = w;
+			}
 		}
-		maxIntensity = m_ATI->processEvents(m_reaction->reactionName());
-		for (int i = 0; i < m_Nt; i++) {
-			t = -(m_ATI->kinematics(i)->particleList()[2] - m_ATI->kinematics(i)->particleList()[3]).M2(); //A.C. definitively need to do this better, but the order should be BEAM 'TARGET RECOIL
-			intensity = m_ATI->intensity(i);
-			m_hTweight->Fill(t, intensity);
+		//the hit-or-miss efficiency with the grid used in this iteration. The max is noisy and the intensity may not factorize
+		//in the grid inputs, so the efficiency does not always go up: the best grid is kept
+		eff = (wMax > 0) ? wSum / m_proposalEvents / wMax : 0;
+		Info("trainProposal", "Iteration %i : efficiency %f", it, eff);
+		if (eff > bestEff) {
+			bestEff = eff;
+			bestGrid = grid;
 		}
-		m_hTweight->Scale(1. / m_Nt);
-		m_wtMax = m_hTweight->GetMaximum();
-		Info("computeEfficiency", "done");
+		grid.Adapt();
 	}
+	grid = bestGrid;
+	Info("trainProposal", "Done, efficiency %f", bestEff);
+	m_proposalDone = true;
+}
 
+void Clas12PhotonsAmplitudeEventGenerator::computeEfficiency() {
+	int it_efficiency = 0;
+	int N_PS;
+	long n, nNeeded;
+	double intensity, maxIntensity, mean, relError;
+	double sumI = 0, sumI2 = 0;
+
+	vector<vector<TLorentzVector> > block;
+
+	if (m_doTweight && !m_TweightDone) this->computeTweight();
+	if (m_proposalIterations > 0 && !m_proposalDone) this->trainProposal();
+
+	/*The efficiency is the average intensity over the max one. The PS events are added in batches until the relative
+	 error on the average is below m_efficiencyPrecision, and the expected number of accepted events above m_savedMin.
+	 Their indices and intensities are kept: they are the first events of the generation.*/
+	m_effIndex.clear();
+	m_effIntensity.clear();
+	maxIntensity = 0;
+	N_PS = m_Nevents;
 	while (1) {
-		Info("computeEfficiency", "Start efficiency computation iteration %i", it_efficiency);
-		m_ATI->clearEvents();
-		N_PS = m_Nevents * pow(10, it_efficiency);
-		Info("computeEfficiency", "Generating %i PS events", N_PS);
-		for (int i = 0; i < N_PS; i++) {
-			m_PSgenerator->Generate();
-			if (m_doTweight) {
-				t = -(m_PSgenerator->GetAllParticlesAmpToolsOrder()[2] - m_PSgenerator->GetAllParticlesAmpToolsOrder()[3]).M2(); //A.C. definitively need to do this better
-				wt = m_hTweight->GetBinContent(m_hTweight->FindBin(t));
-				if (wt < gRandom->Uniform(0, m_wtMax)) {
-					i--;
-					continue;
-				}
-
+		Info("computeEfficiency", "Efficiency iteration %i : generating %i PS events", it_efficiency, N_PS);
+		for (int iFirst = 0; iFirst < N_PS; iFirst += m_PSblockSize) {
+			m_PSindex.clear();
+			this->generatePSEvents(min(m_PSblockSize, N_PS - iFirst), block, &m_PSindex, &m_PSjacobian);
+			m_ATI->clearEvents();
+			for (int i = 0; i < (int) block.size(); i++) {
+				Kinematics m_kin(block[i]);
+				m_ATI->loadEvent(&m_kin, i, block.size());
 			}
-			if (i % (N_PS / 10) == 0) cout << " PS event: " << i << endl;
-			Kinematics m_kin(m_PSgenerator->GetAllParticlesAmpToolsOrder());
-			m_ATI->loadEvent(&m_kin, i, N_PS);
+			m_ATI->processEvents(m_reaction->reactionName());
+			for (int i = 0; i < (int) block.size(); i++) {
+				intensity = m_ATI->intensity(i) * m_PSjacobian[i]; //intensity relative to the proposal
+				if (intensity > maxIntensity) maxIntensity = intensity;
+				sumI += intensity;
+				sumI2 += intensity * intensity;
+				m_effIndex.push_back(m_PSindex[i]);
+				m_effIntensity.push_back(intensity);
+			}
+			cout << " PS event: " << m_effIndex.size() << endl;
 		}
 
+		n = m_effIndex.size();
+		mean = sumI / n;
+		relError = (mean > 0) ? sqrt(max(sumI2 / n - mean * mean, 0.) / n) / mean : 1;
+		m_efficiency = (maxIntensity > 0) ? mean / maxIntensity : 0;
+		Info("computeEfficiency", "Max intensity %f, efficiency %f +- %.2f%% from %li PS events", maxIntensity, m_efficiency, 100 * relError, n);
+		if (relError <= m_efficiencyPrecision && n * m_efficiency > m_savedMin) break;
+
+		//the error goes as 1/sqrt(n): the next batch should reach the target, but at most 10 times the events so far
+		nNeeded = long(n * pow(relError / m_efficiencyPrecision, 2)) + 1;
+		if (m_efficiency > 0) nNeeded = max(nNeeded, long(m_savedMin / m_efficiency) + 1);
+		N_PS = int(min(max(nNeeded - n, (long) m_PSblockSize / 10), 9 * n));
+		it_efficiency++;
+	}
+	Info("computeEfficiency", "Efficiency was computed: %f", m_efficiency);
+	m_maxIntensity = maxIntensity;
+	m_EfficiencyDone = true;
+}
 
-		Info("computeEfficiency", " Efficiency iteration %i, PS events generated. Computing intensity", it_efficiency);
-		maxIntensity = m_ATI->processEvents(m_reaction->reactionName());
-		Info("computeEfficiency", " Intensity computation done. Max intensity is %f", maxIntensity);
-		Info("computeEfficiency", "doing accept/reject...");
+const vector<TLorentzVector>& Clas12PhotonsAmplitudeEventGenerator::getGeneratedEvent(int evt) {
+	if (evt != m_lastEvent) {
+		if (m_storeEvents) {
+			m_generated.GetEvent(evt, m_vP);
+		} else {
+			m_PSgenerator->GenerateEvent(m_generatedIndex[evt]);
+			m_vP = m_PSgenerator->GetEventView().GetAmpToolsOrder(); //copy assignment, no new allocation
+		}
+		m_lastEvent = evt;
+	}
+	return m_vP;
+}
 
-		saved = 0;
+bool Clas12PhotonsAmplitudeEventGenerator::calibrationKey(string &out) const {
+	ostringstream key;
+	ifstream cfg(m_cfgfile.c_str());
 
-		for (int i = 0; i < N_PS; i++) {
-			if ((i % (N_PS / 10)) == 0) cout << "Event " << i << " intensity: " << m_ATI->intensity(i) << endl;
-			intensity = m_ATI->intensity(i);
-			if (intensity > gRandom->Uniform(0, maxIntensity)) {  //if intensity if bigger than random number between 0 and max, keep it.
-				saved++;
-			}
-		}
+	if (!cfg.is_open()) {
+		Error("calibrationKey", "Can't read the configuration file %s", m_cfgfile.c_str());
+		return false;
+	}
+	key << cfg.rdbuf() << "\n";
+	key << setprecision(9);
+	key << "reaction";
+	for (unsigned int ip = 0; ip < m_reaction->particleList().size(); ip++)
+		key << " " << m_reaction->particleList()[ip];
+	key << " Ebeam " << m_PSgenerator->getEbeam();
+	key << " theta " << m_PSgenerator->getThetaMin() << " " << m_PSgenerator->getThetaMax();
+	key << " Eprime " << m_PSgenerator->getEprimeMin() << " " << m_PSgenerator->getEprimeMax();
+	key << " Wdistr " << m_PSgenerator->getWdistrEvents() << " " << m_PSgenerator->getWdistrBins() << " " << m_PSgenerator->getWdistrAdaptive();
+	key << " tweight " << m_doTweight << " " << m_Nt;
+	key << " proposal " << m_proposalIterations << " " << m_proposalEvents << " " << m_proposalBins;
+	out = key.str();
+	return true;
+}
 
-		Info("computeEfficiency", "Done: obtained events are: %i ", saved);
-		if (saved > m_savedMin) {
-			m_efficiency = 1. * saved / N_PS;
-			Info("computeEfficiency", "Efficiency was computed: %f", m_efficiency);
-			break;
-		} else {
-			Info("computeEfficiency", "Too few events. Efficiency was not computed. Repeat!");
-			it_efficiency++;
+bool Clas12PhotonsAmplitudeEventGenerator::calibrationHash(ULong64_t &hash) const {
+	//64-bit FNV-1a
+	string key;
+
+	if (!this->calibrationKey(key)) return false;
+	hash = 14695981039346656037ULL;
+	for (unsigned int i = 0; i < key.size(); i++) {
+		hash ^= (unsigned char) key[i];
+		hash *= 1099511628211ULL;
+	}
+	return true;
+}
+
+bool Clas12PhotonsAmplitudeEventGenerator::saveCalibration(const string &fname) {
+	ULong64_t hash;
+
+	if (!this->calibrationHash(hash)) {
+		Error("saveCalibration", "No configuration key, %s not written", fname.c_str());
+		return false;
+	}
+	ofstream file(fname.c_str());
+	if (!file.good()) {
+		Error("saveCalibration", "Can't write %s", fname.c_str());
+		return false;
+	}
+	if (!m_EfficiencyDone) this->computeEfficiency();
+
+	file << "Clas12Photons calibration" << "\n";
+	file << hex << hash << dec << "\n";
+	file << setprecision(17);
+	file << m_efficiency << " " << m_maxIntensity << "\n";
+	file << m_doTweight << "\n";
+	if (m_doTweight) {
+		file << m_wtMax << " " << m_hTweight->GetNbinsX() << " " << m_hTweight->GetXaxis()->GetXmin() << " " << m_hTweight->GetXaxis()->GetXmax() << "\n";
+		for (int ibin = 0; ibin <= m_hTweight->GetNbinsX() + 1; ibin++) //including under and overflow
+			file << m_hTweight->GetBinContent(ibin) << "\n";
+	}
+	m_PSgenerator->saveWdistr(file);
+	if (m_proposalIterations > 0) { //the grid is part of the proposal, the efficiency goes with it
+		const Clas12PhotonsVegasGrid &grid = m_PSgenerator->getProposal();
+		file << grid.GetNdim() << " " << grid.GetNbins() << "\n";
+		for (unsigned int i = 0; i < grid.GetEdges().size(); i++)
+			file << grid.GetEdges()[i] << "\n";
+	}
+	file.close();
+	if (file.fail()) {
+		Error("saveCalibration", "Can't write %s", fname.c_str());
+		return false;
+	}
+	Info("saveCalibration", "Calibration written to %s", fname.c_str());
+	return true;
+}
+
+bool Clas12PhotonsAmplitudeEventGenerator::loadCalibration(const string &fname) {
+	ifstream file(fname.c_str());
+	string header;
+	ULong64_t hash, expected;
+	double efficiency, maxIntensity, wtMax, xmin, xmax;
+	int doTweight, nbins, nDim, nGridBins;
+	vector<double> contents, edges;
+
+	if (!file.good()) {
+		Error("loadCalibration", "Can't read %s", fname.c_str());
+		return false;
+	}
+	getline(file, header);
+	file >> hex >> hash >> dec;
+	if (header != "Clas12Photons calibration" || file.fail()) {
+		Error("loadCalibration", "%s is not a calibration file", fname.c_str());
+		return false;
+	}
+	if (!this->calibrationHash(expected)) {
+		Error("loadCalibration", "No configuration key, %s not loaded", fname.c_str());
+		return false;
+	}
+	if (hash != expected) {
+		Error("loadCalibration", "%s was made with a different configuration, not loaded", fname.c_str());
+		return false;
+	}
+	file >> efficiency >> maxIntensity >> doTweight;
+	if (doTweight) {
+		file >> wtMax >> nbins >> xmin >> xmax;
+		if (file.fail() || nbins < 1) {
+			Error("loadCalibration", "%s is corrupted", fname.c_str());
+			return false;
 		}
+		contents.resize(nbins + 2);
+		for (int ibin = 0; ibin <= nbins + 1; ibin++)
+			file >> contents[ibin];
+	}
+	file.ignore(1, '\n');
+	if (file.fail() || !m_PSgenerator->loadWdistr(file)) {
+		Error("loadCalibration", "%s is corrupted", fname.c_str());
+		return false;
+	}
+	if (m_proposalIterations > 0) {
+		file >> nDim >> nGridBins;
+		if (file.fail() || nDim != m_PSgenerator->getProposalDim() || nGridBins < 1) {
+			Error("loadCalibration", "%s is corrupted", fname.c_str());
+			return false;
+		}
+		edges.resize(nDim * (nGridBins + 1));
+		for (unsigned int i = 0; i < edges.size(); i++)
+			file >> edges[i];
+		if (file.fail()) {
+			Error("loadCalibration", "%s is corrupted", fname.c_str());
+			return false;
+		}
+		m_PSgenerator->enableProposal(nGridBins);
+		m_PSgenerator->getProposal().SetEdges(nDim, nGridBins, edges);
+		m_proposalDone = true;
+	}
+
+	m_efficiency = efficiency;
+	m_maxIntensity = maxIntensity;
+	if (doTweight) {
+		if (m_hTweight != 0) delete m_hTweight;
+		m_hTweight = new TH1D("m_hTweight", "m_hTweight", nbins, xmin, xmax);
+		for (int ibin = 0; ibin <= nbins + 1; ibin++)
+			m_hTweight->SetBinContent(ibin, contents[ibin]);
+		m_wtMax = wtMax;
+		m_TweightDone = true;
+		this->setTsampling();
 	}
 	m_EfficiencyDone = true;
+	m_effIndex.clear(); //the events of a previous computation do not go with this calibration
+	m_effIntensity.clear();
+	Info("loadCalibration", "Calibration read from %s: efficiency %f, max intensity %f", fname.c_str(), m_efficiency, m_maxIntensity);
+	return true;
 }
 
 double Clas12PhotonsAmplitudeEventGenerator::GetWeight(int evt){
@@ -267,7 +845,8 @@ double Clas12PhotonsAmplitudeEventGenerator::GetWeight(int evt){
 		if (evt >= m_Nevents) {
 			Error("GetDecay", "Request for evt %i, there are only %i events", evt, m_Nevents);
 		}
-		return m_kinVGenerated[evt].weight();
+		if (!m_storeEvents) return m_generatedWeight[evt];
+		return m_generated.GetWeight(evt);
 
 }
 
@@ -280,28 +859,23 @@ TLorentzVector Clas12PhotonsAmplitudeEventGenerator::GetDecay(int evt, int ip) {
 		Error("GetDecay", "Request for evt %i, there are only %i events", evt, m_Nevents);
 	}
 
-	return m_kinVGenerated[evt].particleList()[ip + 2];
+	return this->getGeneratedEvent(evt)[ip + 2];
 
 }
 
-vector<TLorentzVector> Clas12PhotonsAmplitudeEventGenerator::GetFinalStateParticles(int evt) {
-	vector<TLorentzVector> v;
+Clas12PhotonsEventView Clas12PhotonsAmplitudeEventGenerator::GetEventView(int evt) {
+	return Clas12PhotonsEventView(this->getGeneratedEvent(evt));
+}
 
-	v.push_back(m_kinVGenerated[evt].particleList()[1]); //scattered e'
+Clas12PhotonsEventView Clas12PhotonsAmplitudeEventGenerator::GetFinalStateView(int evt) {
+	return Clas12PhotonsEventView(this->getGeneratedEvent(evt), true); //scattered e', then all the others
+}
 
-	for (int ip = 0; ip < (m_Np-1); ip++) {
-		v.push_back(m_kinVGenerated[evt].particleList()[ip + 3]); //all the others
-	}
-	return v;
+vector<TLorentzVector> Clas12PhotonsAmplitudeEventGenerator::GetFinalStateParticles(int evt) {
+	return this->GetFinalStateView(evt).Copy();
 }
 
 vector<TLorentzVector> Clas12PhotonsAmplitudeEventGenerator::GetAllParticlesAmpToolsOrder(int evt) {
-	vector<TLorentzVector> v;
-
-	for (int ip = 0; ip < m_Np + 2; ip++) { //plus2 because of initial state
-		v.push_back(m_kinVGenerated[evt].particleList()[ip]);
-	}
-	return v;
-
+	return this->GetEventView(evt).Copy();
 }
 
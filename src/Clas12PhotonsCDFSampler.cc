@@ -0,0 +1,122 @@
+#include <algorithm>
+
+#include "Clas12PhotonsCDFSampler.h"
+
+#include "TError.h"
+
+void Clas12PhotonsCDFSampler::Build(vector<double> &samples, double xmin, double xmax, int nbins, bool adaptive) {
+	vector<double> edges, contents;
+	int N, iFirst, iLast;
+	double x;
+
+	sort(samples.begin(), samples.end());
+	//only the samples in the range count
+	iFirst = lower_bound(samples.begin(), samples.end(), xmin) - samples.begin();
+	iLast = upper_bound(samples.begin(), samples.end(), xmax) - samples.begin();
+	N = iLast - iFirst;
+
+	if (nbins < 1) nbins = 1;
+	if (adaptive && N < 2 * nbins) {
+		Warning("Build", "Only %i samples for %i adaptive bins, using uniform bins", N, nbins);
+		adaptive = false;
+	}
+
+	edges.push_back(xmin);
+	if (adaptive) {
+		//the edge between two bins is half way between the two samples around it
+		for (int k = 1; k < nbins; k++) {
+			x = 0.5 * (samples[iFirst + (long) k * N / nbins - 1] + samples[iFirst + (long) k * N / nbins]);
+			if (x > edges.back()) edges.push_back(x);
+		}
+	} else {
+		for (int k = 1; k < nbins; k++)
+			edges.push_back(xmin + (xmax - xmin) * k / nbins);
+	}
+	edges.push_back(xmax);
+
+	contents.assign(edges.size() - 1, 0);
+	for (int k = 0; k < (int) contents.size(); k++)
+		contents[k] = lower_bound(samples.begin() + iFirst, samples.begin() + iLast, edges[k + 1]) - lower_bound(samples.begin() + iFirst, samples.begin() + iLast, edges[k]);
+	contents.back() += upper_bound(samples.begin() + iFirst, samples.begin() + iLast, xmax) - lower_bound(samples.begin() + iFirst, samples.begin() + iLast, xmax); //x = xmax
+
+	this->SetDistribution(contents.size(), &(edges[0]), &(contents[0]));
+}
+
+void Clas12PhotonsCDFSampler::SetDistribution(int nbins, const double *edges, const double *contents) {
+	int i;
+
+	m_edges.assign(edges, edges + nbins + 1);
+	m_cdf.assign(nbins + 1, 0);
+	for (i = 0; i < nbins; i++)
+		m_cdf[i + 1] = m_cdf[i] + contents[i];
+
+	if (m_cdf[nbins] <= 0) {
+		Error("SetDistribution", "The distribution is empty");
+		m_edges.clear();
+		m_cdf.clear();
+		m_guide.clear();
+		return;
+	}
+	for (i = 1; i <= nbins; i++)
+		m_cdf[i] /= m_cdf[nbins];
+	m_cdf[nbins] = 1;
+
+	m_guide.resize(nbins);
+	i = 0;
+	for (int k = 0; k < nbins; k++) {
+		while (m_cdf[i + 1] <= 1. * k / nbins)
+			i++;
+		m_guide[k] = i;
+	}
+}
+
+int Clas12PhotonsCDFSampler::findBinCDF(double F) const {
+	int nbins = m_guide.size();
+	int k = (int) (F * nbins);
+	int i;
+
+	if (k >= nbins) k = nbins - 1;
+	if (k < 0) k = 0;
+	i = m_guide[k];
+	while ((i < nbins - 1) && (m_cdf[i + 1] <= F))
+		i++;
+	return i;
+}
+
+double Clas12PhotonsCDFSampler::CDF(double x) const {
+	int i;
+
+	if (x <= m_edges.front()) return 0;
+	if (x >= m_edges.back()) return 1;
+	i = upper_bound(m_edges.begin(), m_edges.end(), x) - m_edges.begin() - 1;
+	return m_cdf[i] + (m_cdf[i + 1] - m_cdf[i]) * (x - m_edges[i]) / (m_edges[i + 1] - m_edges[i]);
+}
+
+double Clas12PhotonsCDFSampler::Density(double x) const {
+	int i;
+
+	if (x < m_edges.front() || x > m_edges.back()) return 0;
+	i = upper_bound(m_edges.begin(), m_edges.end(), x) - m_edges.begin() - 1;
+	if (i >= (int) m_edges.size() - 1) i = m_edges.size() - 2;
+	return (m_cdf[i + 1] - m_cdf[i]) / (m_edges[i + 1] - m_edges[i]);
+}
+
+double Clas12PhotonsCDFSampler::Sample(double u) const {
+	int i = findBinCDF(u);
+	double dF = m_cdf[i + 1] - m_cdf[i];
+
+	if (dF <= 0) return m_edges[i];
+	return m_edges[i] + (m_edges[i + 1] - m_edges[i]) * (u - m_cdf[i]) / dF;
+}
+
+double Clas12PhotonsCDFSampler::Sample(double u, double xmin, double xmax) const {
+	double F0 = CDF(xmin);
+	double F1 = CDF(xmax);
+	double x;
+
+	if (F1 <= F0) return xmin + u * (xmax - xmin); //no probability in the range
+	x = Sample(F0 + u * (F1 - F0));
+	if (x < xmin) x = xmin;
+	if (x > xmax) x = xmax;
+	return x;
+}
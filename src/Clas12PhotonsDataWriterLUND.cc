@@ -8,37 +8,165 @@
 #include "Clas12PhotonsDataWriterLUND.h"
 #include "TDatabasePDG.h"
 #include "TParticlePDG.h"
-#include <sstream>   
+#include <sstream>
+#include <cstdio>
+#include <cmath>
 
 
+//powers of 10 for the formatting
+static const double pow10[] = { 1e-4, 1e-3, 1e-2, 1e-1, 1, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9 };
+static const long long ipow10[] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000 };
+
 Clas12PhotonsDataWriterLUND::Clas12PhotonsDataWriterLUND(const string& outFile) {
-	// TODO Auto-generated constructor stub
 	m_outFile.open(outFile.c_str());
-	m_eventCounter = 0;   
+	m_eventCounter = 0;
 	m_PDGdb=TDatabasePDG::Instance();
 
-	m_PDGparticle=0;
+	m_bufferSize = 1 << 22;
+	m_buffer.reserve(m_bufferSize + 4096);
 
+	m_async = false;
+	m_batchSize = 0;
+	m_current = 0;
+	m_busy = false;
+	m_closing = false;
+	m_failed = false;
 }
 
 Clas12PhotonsDataWriterLUND::~Clas12PhotonsDataWriterLUND() {
-	// TODO Auto-generated destructor stub
-	m_outFile.close();
+	this->close();
+}
+
+void Clas12PhotonsDataWriterLUND::setAsync(int nBuffers, int batchSize) {
+	if (m_async) {
+		Warning("setAsync", "Already asynchronous");
+		return;
+	}
+	if (nBuffers < 2) nBuffers = 2;
+	if (batchSize < 1) batchSize = 1;
+	m_batchSize = batchSize;
+	m_batches.assign(nBuffers, Batch());
+	m_free.clear();
+	for (int i = 1; i < nBuffers; i++)
+		m_free.push_back(&m_batches[i]);
+	m_current = &m_batches[0];
+	m_full.clear();
+	m_busy = false;
+	m_closing = false;
+	m_async = true;
+	m_thread = std::thread(&Clas12PhotonsDataWriterLUND::writerLoop, this);
+}
+
+bool Clas12PhotonsDataWriterLUND::flush() {
+	if (m_async) {
+		if (!m_current->nP.empty()) this->submitBatch();
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_cond.wait(lock, [this] { return m_full.empty() && !m_busy; });
+		//the writer thread is idle until the next batch
+		m_outFile.write(m_buffer.data(), m_buffer.size());
+		m_buffer.clear();
+		m_outFile.flush();
+		if (!m_outFile.good()) m_failed = true;
+		return !m_failed;
+	}
+	m_outFile.write(m_buffer.data(), m_buffer.size());
+	m_buffer.clear();
+	m_outFile.flush();
+	return m_outFile.good();
+}
+
+bool Clas12PhotonsDataWriterLUND::close() {
+	bool good;
+
+	if (!m_async && !m_outFile.is_open()) return !m_failed; //already closed
+	good = this->flush();
+	if (m_async) {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_closing = true;
+		}
+		m_cond.notify_all();
+		m_thread.join();
+		m_async = false;
+	}
+	if (m_outFile.is_open()) m_outFile.close();
+	return good && !m_outFile.fail();
+}
+
+//the current batch goes to the writer thread, waiting for a free one if needed
+void Clas12PhotonsDataWriterLUND::submitBatch() {
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	m_full.push_back(m_current);
+	m_cond.notify_all();
+	m_cond.wait(lock, [this] { return !m_free.empty(); });
+	m_current = m_free.back();
+	m_free.pop_back();
+}
+
+void Clas12PhotonsDataWriterLUND::writerLoop() {
+	std::unique_lock<std::mutex> lock(m_mutex);
+	Batch *batch;
+	bool good;
+
+	while (true) {
+		m_cond.wait(lock, [this] { return !m_full.empty() || m_closing; });
+		if (m_full.empty()) return; //closing, all written
+		batch = m_full.front();
+		m_full.pop_front();
+		m_busy = true;
+		good = !m_failed; //after an error the batches are dropped
+		lock.unlock();
+
+		if (good) {
+			this->formatBatch(*batch);
+			if (m_buffer.size() > m_bufferSize) {
+				m_outFile.write(m_buffer.data(), m_buffer.size());
+				m_buffer.clear();
+			}
+			good = m_outFile.good();
+		}
+		batch->nP.clear();
+		batch->weight.clear();
+		batch->p.clear();
+		batch->pid.clear();
+		batch->status.clear();
+		batch->info.clear();
+
+		lock.lock();
+		if (!good) m_failed = true;
+		m_busy = false;
+		m_free.push_back(batch);
+		m_cond.notify_all();
+	}
 }
 
-void Clas12PhotonsDataWriterLUND::writeEvent(const Kinematics& kin,const vector<TVector3>& vertex,int *pid,int *status){
-	m_kin=kin;
-	m_nP=m_kin.particleList().size();
-	if (vertex.size()!=m_nP){
-	  Error("writeEvent","vertex entries are:%i while 4-momenta entries are: %i",vertex.size(),m_nP);
-	  return;
+void Clas12PhotonsDataWriterLUND::formatBatch(const Batch &batch) {
+	int k = 0;
+
+	for (unsigned int ievt = 0; ievt < batch.nP.size(); ievt++) {
+		this->header_line(batch.nP[ievt], batch.weight[ievt]);
+		for (int ip = 0; ip < batch.nP[ievt]; ip++, k++)
+			this->particle_line(ip, &(batch.p[7 * k]), batch.pid[k], batch.status[k], *(batch.info[k]));
 	}
+}
+
+bool Clas12PhotonsDataWriterLUND::writeEvent(const Kinematics& kin,const vector<TVector3>& vertex,int *pid,int *status){
+	return this->writeEvent(kin.particleList(), vertex, pid, status, kin.weight());
+}
 
-	m_vertex=vertex;
-	m_pid=pid;
-	m_status=status;
-	
+bool Clas12PhotonsDataWriterLUND::writeEvent(const vector<TLorentzVector>& P,const vector<TVector3>& vertex,int *pid,int *status,double weight){
+	int nP = P.size();
+	double p[7];
 
+	if (vertex.size()!=nP){
+	  Error("writeEvent","vertex entries are:%i while 4-momenta entries are: %i",(int) vertex.size(),nP);
+	  return false;
+	}
+	if (pid==0){
+	  Error("writeEvent","no pid is provided - pointer of pid is 0!");
+	  return false;
+	}
 
 	/*start writing output
 	//header line has 10 entries. Only first one is meaningfull
@@ -68,66 +196,166 @@ void Clas12PhotonsDataWriterLUND::writeEvent(const Kinematics& kin,const vector<
 	vertex y (cm)
 	vertex z (cm)
 	*/
-	this->header_line();
-	m_outFile<<m_header<<endl;
-	for (int ip=0;ip<m_nP;ip++){
-	  this->particle_line(ip);
-	  m_outFile<<m_particle<<endl;
+	if (m_async) {
+	  if (m_failed) return false; //dropped, the writer thread stopped writing
+	  m_eventCounter++;
+	  //the charge and mass are looked up here, the writer thread only reads them
+	  m_current->nP.push_back(nP);
+	  m_current->weight.push_back(weight);
+	  for (int ip=0;ip<nP;ip++){
+	    m_current->p.insert(m_current->p.end(), { P[ip].Px(), P[ip].Py(), P[ip].Pz(), P[ip].E(), vertex[ip].X(), vertex[ip].Y(), vertex[ip].Z() });
+	    m_current->pid.push_back(pid[ip]);
+	    m_current->status.push_back((status==0) ? 1 : status[ip]);
+	    m_current->info.push_back(&(this->getPIDinfo(pid[ip])));
+	  }
+	  if ((int) m_current->nP.size() >= m_batchSize) this->submitBatch();
+	  return !m_failed;
 	}
-}
 
-void Clas12PhotonsDataWriterLUND::writeEvent(const vector<TLorentzVector>& P,const vector<TVector3>& vertex,int *pid,int *status,double weight){
-	Kinematics kin(P,weight);
-	this->writeEvent(kin,vertex,pid,status);
+	m_eventCounter++;
+	this->header_line(nP, weight);
+	for (int ip=0;ip<nP;ip++){
+	  p[0] = P[ip].Px();
+	  p[1] = P[ip].Py();
+	  p[2] = P[ip].Pz();
+	  p[3] = P[ip].E();
+	  p[4] = vertex[ip].X();
+	  p[5] = vertex[ip].Y();
+	  p[6] = vertex[ip].Z();
+	  this->particle_line(ip, p, pid[ip], (status==0) ? 1 : status[ip], this->getPIDinfo(pid[ip]));
+	}
+	if (m_buffer.size() > m_bufferSize) {
+	  m_outFile.write(m_buffer.data(), m_buffer.size());
+	  m_buffer.clear();
+	}
+	return m_outFile.good();
 }
 
-void Clas12PhotonsDataWriterLUND::header_line(){
-  ostringstream stream;
-  stream<<m_nP<<" "; //number of particles
-  stream<<"0 0 0 0 0 0 0 0 "; //8 fields not used
-  stream<<m_kin.weight(); //save the event weight in the last header field
-
-  m_header=stream.str();
+void Clas12PhotonsDataWriterLUND::header_line(int nP, double weight){
+  this->append(nP); //number of particles
+  m_buffer += " 0 0 0 0 0 0 0 0 "; //8 fields not used
+  this->append(weight); //save the event weight in the last header field
+  m_buffer += '\n';
 }
 
-void Clas12PhotonsDataWriterLUND::particle_line(int np){
-  ostringstream stream;
-  int status;
-  if (m_pid==0){
-    Error("particle_line","no pid is provided - pointer of m_pid is 0!");
-    return;
-  }
-  if (m_status==0) status=1;
-  else status=m_status[np];
-
-
- 
- 
-  m_PDGparticle=m_PDGdb->GetParticle(m_pid[np]);
-
+void Clas12PhotonsDataWriterLUND::particle_line(int np, const double *p, int pid, int status, const PIDinfo &info){
   //index (COUNTING FROM 1, otherwise GEMC doesn't work)
-  stream<<np+1<<" ";
+  this->append(np + 1);
+  m_buffer += ' ';
   //charge
-  stream<<m_PDGparticle->Charge()/3<<" "; //Charge() returns in units of |e|/3
+  m_buffer += info.charge;
+  m_buffer += ' ';
   //status
-  stream<<status<<" ";
+  this->append(status);
+  m_buffer += ' ';
   //PID
-  stream<<m_pid[np]<<" ";
+  this->append(pid);
   //parent and daughter index - not used
-  stream<<"0 0 ";
+  m_buffer += " 0 0 ";
   //momentum px py pz (GeV)
-  stream<<m_kin.particle(np).Px()<<" "<<m_kin.particle(np).Py()<<" "<<m_kin.particle(np).Pz()<<" ";
+  this->append(p[0]);
+  m_buffer += ' ';
+  this->append(p[1]);
+  m_buffer += ' ';
+  this->append(p[2]);
+  m_buffer += ' ';
   //energy
-  stream<<m_kin.particle(np).E()<<" ";
+  this->append(p[3]);
+  m_buffer += ' ';
   //mass
-  stream<<m_PDGparticle->Mass()<<" ";
+  m_buffer += info.mass;
+  m_buffer += ' ';
   //vertex
-  stream<<m_vertex[np].X()<<" "<<m_vertex[np].Y()<<" "<<m_vertex[np].Z();
+  this->append(p[4]);
+  m_buffer += ' ';
+  this->append(p[5]);
+  m_buffer += ' ';
+  this->append(p[6]);
+  m_buffer += '\n';
+}
 
-  
-  m_particle=stream.str();
-  
+const Clas12PhotonsDataWriterLUND::PIDinfo& Clas12PhotonsDataWriterLUND::getPIDinfo(int pid){
+  std::unordered_map<int, PIDinfo>::const_iterator it = m_PIDtable.find(pid);
+  if (it != m_PIDtable.end()) return it->second;
 
+  PIDinfo &info = m_PIDtable[pid];
+  TParticlePDG *particle = m_PDGdb->GetParticle(pid);
+  if (particle == 0) {
+    Error("getPIDinfo", "PID %i is not in the PDG database, writing charge and mass 0", pid);
+    info.charge = "0";
+    info.mass = "0";
+    return info;
+  }
+  ostringstream charge, mass;
+  charge << particle->Charge() / 3; //Charge() returns in units of |e|/3
+  mass << particle->Mass();
+  info.charge = charge.str();
+  info.mass = mass.str();
+  return info;
+}
+
+void Clas12PhotonsDataWriterLUND::append(int n){
+  char buf[16];
+  int i = 0;
+  unsigned int u = (n < 0) ? -(unsigned int) n : n;
+
+  do {
+    buf[i++] = '0' + u % 10;
+    u /= 10;
+  } while (u > 0);
+  if (n < 0) m_buffer += '-';
+  while (i > 0)
+    m_buffer += buf[--i];
+}
+
+//x * 10^d rounded to the closest integer, false if too close to a tie to be sure of the rounding of the exact decimal value
+static bool roundDecimals(double x, int d, long long &m) {
+  double r = x * ipow10[d];
+  double f = r - floor(r);
+  if (fabs(f - 0.5) < 1e-6) return false;
+  m = (long long) floor(r) + (f > 0.5);
+  return true;
+}
+
+/*Same text as printf %g (and the ostream default), 6 significant digits. Between 1e-4 and 1e6 the number is rounded to an integer
+ with the right number of decimals, and the digits are written directly. The rest, and the rare values close to a tie, go through snprintf.*/
+void Clas12PhotonsDataWriterLUND::append(double x){
+  char buf[32];
+  double a = fabs(x);
+  int e, d, n;
+  long long m, ip, fp;
+  bool ok = (a >= 1e-4 && a < 1e6);
 
+  if (ok) {
+    //a is in [10^e, 10^(e+1))
+    e = 5;
+    while (a < pow10[e + 4])
+      e--;
+    d = 5 - e;
+    ok = roundDecimals(a, d, m);
+    if (ok && m >= 1000000) { //rounded up to the next power of 10
+      d--;
+      ok = (d >= 0) && roundDecimals(a, d, m);
+    }
+  }
+  if (!ok) {
+    m_buffer.append(buf, snprintf(buf, sizeof(buf), "%g", x));
+    return;
+  }
+  ip = m / ipow10[d];
+  fp = m % ipow10[d];
 
+  if (x < 0) m_buffer += '-';
+  this->append((int) ip);
+  if (fp == 0) return;
+  //the decimals, without the trailing zeros
+  n = d;
+  while (fp % 10 == 0) {
+    fp /= 10;
+    n--;
+  }
+  m_buffer += '.';
+  for (int i = n - 1; i >= 0; i--)
+    buf[i] = '0' + fp % 10, fp /= 10;
+  m_buffer.append(buf, n);
 }
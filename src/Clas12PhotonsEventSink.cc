@@ -0,0 +1,25 @@
+#include "Clas12PhotonsEventSink.h"
+#include "Clas12PhotonsDataWriterLUND.h"
+
+#include "TError.h"
+
+Clas12PhotonsEventSinkLUND::Clas12PhotonsEventSinkLUND(Clas12PhotonsDataWriterLUND &writer, const vector<int> &pid, const vector<TVector3> &vertex) :
+		m_writer(writer), m_pid(pid), m_vertex(vertex) {
+	if (m_vertex.size() == 0) m_vertex.assign(m_pid.size(), TVector3(0, 0, 0));
+}
+
+bool Clas12PhotonsEventSinkLUND::writeEvent(const vector<TLorentzVector> &event, double weight) {
+	if (event.size() != m_pid.size() + 2 || m_vertex.size() != m_pid.size()) {
+		Error("writeEvent", "Event with %i particles, %i pids and %i vertexes", (int) event.size() - 2, (int) m_pid.size(), (int) m_vertex.size());
+		return false;
+	}
+	m_P.resize(m_pid.size());
+	m_P[0] = event[1]; //scattered e'
+	for (unsigned int ip = 3; ip < event.size(); ip++)
+		m_P[ip - 2] = event[ip]; //all the others
+	return m_writer.writeEvent(m_P, m_vertex, &(m_pid[0]), 0, weight); //false stops the generation on an I/O error
+}
+
+void Clas12PhotonsEventSinkLUND::end() {
+	if (!m_writer.flush()) Error("end", "Error writing the LUND file");
+}
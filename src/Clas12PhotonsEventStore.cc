@@ -0,0 +1,81 @@
+#include "Clas12PhotonsEventStore.h"
+
+#include "TError.h"
+
+Clas12PhotonsEventStore::Clas12PhotonsEventStore(int nParticles) {
+	this->Init(nParticles);
+}
+
+void Clas12PhotonsEventStore::Init(int nParticles) {
+	m_nParticles = (nParticles < 0) ? 0 : nParticles;
+	m_p.assign(4 * m_nParticles, Column());
+	this->Clear();
+}
+
+void Clas12PhotonsEventStore::Clear() {
+	for (unsigned int ic = 0; ic < m_p.size(); ic++)
+		m_p[ic].clear();
+	m_weight.clear();
+	m_intensity.clear();
+	m_accept.clear();
+}
+
+void Clas12PhotonsEventStore::Reserve(long n) {
+	for (unsigned int ic = 0; ic < m_p.size(); ic++)
+		m_p[ic].reserve(n);
+	m_weight.reserve(n);
+	m_intensity.reserve(n);
+	m_accept.reserve(n);
+}
+
+long Clas12PhotonsEventStore::Append(const vector<TLorentzVector> &event, double weight, double intensity) {
+	if ((int) event.size() != m_nParticles) {
+		Error("Append", "Event with %i particles in a store of %i", (int) event.size(), m_nParticles);
+		return -1;
+	}
+	for (int ip = 0; ip < m_nParticles; ip++) {
+		m_p[4 * ip].push_back(event[ip].Px());
+		m_p[4 * ip + 1].push_back(event[ip].Py());
+		m_p[4 * ip + 2].push_back(event[ip].Pz());
+		m_p[4 * ip + 3].push_back(event[ip].E());
+	}
+	m_weight.push_back(weight);
+	m_intensity.push_back(intensity);
+	m_accept.push_back(1);
+	return m_weight.size() - 1;
+}
+
+void Clas12PhotonsEventStore::GetEvent(long i, vector<TLorentzVector> &event) const {
+	event.resize(m_nParticles);
+	for (int ip = 0; ip < m_nParticles; ip++)
+		event[ip].SetPxPyPzE(m_p[4 * ip][i], m_p[4 * ip + 1][i], m_p[4 * ip + 2][i], m_p[4 * ip + 3][i]);
+}
+
+void Clas12PhotonsEventStore::ScaleWeights(double f) {
+	for (unsigned int i = 0; i < m_weight.size(); i++)
+		m_weight[i] *= f;
+}
+
+long Clas12PhotonsEventStore::Compact() {
+	long n = 0, N = m_weight.size();
+
+	//one pass per column, each one sequential
+	for (unsigned int ic = 0; ic < m_p.size(); ic++) {
+		double *p = m_p[ic].data();
+		n = 0;
+		for (long i = 0; i < N; i++)
+			if (m_accept[i]) p[n++] = p[i];
+		m_p[ic].resize(n);
+	}
+	n = 0;
+	for (long i = 0; i < N; i++) {
+		if (!m_accept[i]) continue;
+		m_weight[n] = m_weight[i];
+		m_intensity[n] = m_intensity[i];
+		n++;
+	}
+	m_weight.resize(n);
+	m_intensity.resize(n);
+	m_accept.assign(n, 1);
+	return n;
+}
@@ -0,0 +1,318 @@
+#include "Clas12PhotonsLeptonicCurrent.h"
+
+#include <cmath>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+/*Vector type used by the kernel. The arithmetic operators on __m512d / __m256d are provided by the compiler (gcc and clang vector extensions),
+ only the few operations below need an explicit intrinsic.*/
+
+static inline double lcSet(double x, double) {
+	return x;
+}
+static inline double lcSqrt(double x) {
+	return sqrt(x);
+}
+static inline void lcStore(double *p, double x) {
+	*p = x;
+}
+
+#if defined(__AVX512F__)
+
+typedef __m512d LCVec;
+static const int LCWidth = 8;
+static const char LCInstructionSet[] = "AVX-512";
+
+static inline LCVec lcSet(double x, LCVec) {
+	return _mm512_set1_pd(x);
+}
+static inline LCVec lcSqrt(LCVec x) {
+	return _mm512_sqrt_pd(x);
+}
+static inline LCVec lcLoad(const double *p, LCVec) {
+	return _mm512_loadu_pd(p);
+}
+static inline void lcStore(double *p, LCVec x) {
+	_mm512_storeu_pd(p, x);
+}
+
+#elif defined(__AVX2__)
+
+typedef __m256d LCVec;
+static const int LCWidth = 4;
+static const char LCInstructionSet[] = "AVX2";
+
+static inline LCVec lcSet(double x, LCVec) {
+	return _mm256_set1_pd(x);
+}
+static inline LCVec lcSqrt(LCVec x) {
+	return _mm256_sqrt_pd(x);
+}
+static inline LCVec lcLoad(const double *p, LCVec) {
+	return _mm256_loadu_pd(p);
+}
+static inline void lcStore(double *p, LCVec x) {
+	_mm256_storeu_pd(p, x);
+}
+
+#else
+
+typedef double LCVec;
+static const int LCWidth = 1;
+static const char LCInstructionSet[] = "scalar";
+
+static inline LCVec lcLoad(const double *p, LCVec) {
+	return *p;
+}
+
+#endif
+
+//structure-of-arrays buffers for one block of events. The block is padded up to a multiple of the vector width
+struct LCBlock {
+	alignas(64) double bE[Clas12PhotonsLeptonicCurrent::blockSize];
+	alignas(64) double bx[Clas12PhotonsLeptonicCurrent::blockSize];
+	alignas(64) double by[Clas12PhotonsLeptonicCurrent::blockSize];
+	alignas(64) double bz[Clas12PhotonsLeptonicCurrent::blockSize];
+	alignas(64) double eE[Clas12PhotonsLeptonicCurrent::blockSize];
+	alignas(64) double ex[Clas12PhotonsLeptonicCurrent::blockSize];
+	alignas(64) double ey[Clas12PhotonsLeptonicCurrent::blockSize];
+	alignas(64) double ez[Clas12PhotonsLeptonicCurrent::blockSize];
+	alignas(64) double rx[Clas12PhotonsLeptonicCurrent::blockSize];
+	alignas(64) double ry[Clas12PhotonsLeptonicCurrent::blockSize];
+	alignas(64) double rz[Clas12PhotonsLeptonicCurrent::blockSize];
+
+	alignas(64) double JPre[Clas12PhotonsLeptonicCurrent::blockSize];
+	alignas(64) double JPim[Clas12PhotonsLeptonicCurrent::blockSize];
+	alignas(64) double JMre[Clas12PhotonsLeptonicCurrent::blockSize];
+	alignas(64) double JMim[Clas12PhotonsLeptonicCurrent::blockSize];
+};
+
+/*Helicity frame basis (lab components): z along the photon, x along the recoil component orthogonal to it, y=z x x.
+ This is the frame reached by the three rotations in Clas12PhotonsAmplitude::calcElectronScattering*/
+template<class V> static inline void lcFrame(V gx, V gy, V gz, V rx, V ry, V rz, V &xx, V &xy, V &xz, V &yx, V &yy, V &yz, V &zx, V &zy, V &zz) {
+
+	const V one = lcSet(1., V());
+
+	V gInv = one / lcSqrt(gx * gx + gy * gy + gz * gz);
+	zx = gx * gInv;
+	zy = gy * gInv;
+	zz = gz * gInv;
+
+	V rDotZ = rx * zx + ry * zy + rz * zz;
+	V px = rx - rDotZ * zx;
+	V py = ry - rDotZ * zy;
+	V pz = rz - rDotZ * zz;
+	V pInv = one / lcSqrt(px * px + py * py + pz * pz);
+	xx = px * pInv;
+	xy = py * pInv;
+	xz = pz * pInv;
+
+	yx = zy * xz - zz * xy;
+	yy = zz * xx - zx * xz;
+	yz = zx * xy - zy * xx;
+}
+
+/*Computes the current from the beam, e' and recoil momenta (lab frame).
+ beamPlus selects the (+1,+1) configuration, otherwise (-1,-1): the helicity-flip ones are handled by the caller.
+ Being a template parameter, the selection is resolved at compile time*/
+template<class V, bool beamPlus> static inline void lcCurrent(V bE, V bx, V by, V bz, V eE, V ex, V ey, V ez, V rx, V ry, V rz, V &JPre, V &JPim, V &JMre, V &JMim) {
+
+	const V zero = lcSet(0., V());
+	const V one = lcSet(1., V());
+	const V two = lcSet(2., V());
+
+	V xx, xy, xz, yx, yy, yz, zx, zy, zz;
+
+	//virtual photon and Q2
+	V gx = bx - ex;
+	V gy = by - ey;
+	V gz = bz - ez;
+	V gE = bE - eE;
+	V Q2 = gx * gx + gy * gy + gz * gz - gE * gE;
+
+	lcFrame<V>(gx, gy, gz, rx, ry, rz, xx, xy, xz, yx, yy, yz, zx, zy, zz);
+
+	//beam and e' in the helicity frame
+	V b1 = bx * xx + by * xy + bz * xz;
+	V b2 = bx * yx + by * yy + bz * yz;
+	V b3 = bx * zx + by * zy + bz * zz;
+	V e1 = ex * xx + ey * xy + ez * xz;
+	V e2 = ex * yx + ey * yy + ez * yz;
+	V e3 = ex * zx + ey * zy + ez * zz;
+
+	//cos(theta/2) = sqrt((P+Pz)/2P), sin(theta/2)*exp(i*phi) = (Px+iPy)/sqrt(2P(P+Pz))
+	V bP = lcSqrt(b1 * b1 + b2 * b2 + b3 * b3);
+	V eP = lcSqrt(e1 * e1 + e2 * e2 + e3 * e3);
+	V bPlus = bP + b3;
+	V ePlus = eP + e3;
+	V c1 = lcSqrt(bPlus / (two * bP));
+	V c2 = lcSqrt(ePlus / (two * eP));
+	V n1 = one / lcSqrt(two * bP * bPlus);
+	V n2 = one / lcSqrt(two * eP * ePlus);
+
+	//2*sqrt(2 E1 E2)/Q2
+	V norm = two * lcSqrt(two * bE * eE) / Q2;
+
+	V a = norm * c1 * n2; //multiplies e'(x,y)
+	V c = norm * c2 * n1; //multiplies beam(x,y)
+
+	if (beamPlus) {
+		//JP = N cos(theta1/2) sin(theta2/2) exp(-i phi2), JM = -N cos(theta2/2) sin(theta1/2) exp(i phi1)
+		JPre = a * e1;
+		JPim = zero - a * e2;
+		JMre = zero - c * b1;
+		JMim = zero - c * b2;
+	} else {
+		//JP = N cos(theta2/2) sin(theta1/2) exp(-i phi1), JM = -N cos(theta1/2) sin(theta2/2) exp(i phi2)
+		JPre = c * b1;
+		JPim = zero - c * b2;
+		JMre = zero - a * e1;
+		JMim = zero - a * e2;
+	}
+}
+
+//the events i..i+LCWidth-1 of the block
+template<bool beamPlus> static inline void lcKernel(LCBlock &b, int i) {
+	const LCVec zero = lcSet(0., LCVec());
+	LCVec JPre, JPim, JMre, JMim;
+
+	lcCurrent<LCVec, beamPlus>(lcLoad(b.bE + i, zero), lcLoad(b.bx + i, zero), lcLoad(b.by + i, zero), lcLoad(b.bz + i, zero), lcLoad(b.eE + i, zero), lcLoad(b.ex + i, zero),
+			lcLoad(b.ey + i, zero), lcLoad(b.ez + i, zero), lcLoad(b.rx + i, zero), lcLoad(b.ry + i, zero), lcLoad(b.rz + i, zero), JPre, JPim, JMre, JMim);
+
+	lcStore(b.JPre + i, JPre);
+	lcStore(b.JPim + i, JPim);
+	lcStore(b.JMre + i, JMre);
+	lcStore(b.JMim + i, JMim);
+}
+
+const char* Clas12PhotonsLeptonicCurrent::instructionSet() {
+	return LCInstructionSet;
+}
+
+void Clas12PhotonsLeptonicCurrent::calcBatch(const GDouble* pdData, int iNEvents, int iNParticles, int helicityBeam, int helicityElectron, complex<GDouble>* JP,
+		complex<GDouble>* J0, complex<GDouble>* JM) {
+
+	const int Ibeam = 0;
+	const int Iscattered = 1;
+	const int Irecoil = 3;
+
+	const int stride = 4 * iNParticles;
+	bool beamPlus;
+
+	//J0 is always 0, as are all the components for the helicity-flip configurations
+	for (int iEvent = 0; iEvent < iNEvents; iEvent++)
+		J0[iEvent] = 0;
+
+	if ((helicityBeam == 1) && (helicityElectron == 1)) beamPlus = true;
+	else if ((helicityBeam == -1) && (helicityElectron == -1)) beamPlus = false;
+	else {
+		for (int iEvent = 0; iEvent < iNEvents; iEvent++) {
+			JP[iEvent] = 0;
+			JM[iEvent] = 0;
+		}
+		return;
+	}
+
+	LCBlock block;
+	const GDouble *ev;
+	int n, nPadded, i, src;
+
+	for (int iFirst = 0; iFirst < iNEvents; iFirst += blockSize) {
+		n = iNEvents - iFirst;
+		if (n > blockSize) n = blockSize;
+		nPadded = ((n + LCWidth - 1) / LCWidth) * LCWidth;
+
+		//AoS -> SoA. The padding lanes replicate the first event, so that they never produce NaN
+		for (i = 0; i < nPadded; i++) {
+			src = (i < n) ? i : 0;
+			ev = pdData + (iFirst + src) * stride;
+			block.bE[i] = ev[4 * Ibeam + 0];
+			block.bx[i] = ev[4 * Ibeam + 1];
+			block.by[i] = ev[4 * Ibeam + 2];
+			block.bz[i] = ev[4 * Ibeam + 3];
+			block.eE[i] = ev[4 * Iscattered + 0];
+			block.ex[i] = ev[4 * Iscattered + 1];
+			block.ey[i] = ev[4 * Iscattered + 2];
+			block.ez[i] = ev[4 * Iscattered + 3];
+			block.rx[i] = ev[4 * Irecoil + 1];
+			block.ry[i] = ev[4 * Irecoil + 2];
+			block.rz[i] = ev[4 * Irecoil + 3];
+		}
+
+		if (beamPlus) {
+			for (i = 0; i < nPadded; i += LCWidth)
+				lcKernel<true>(block, i);
+		} else {
+			for (i = 0; i < nPadded; i += LCWidth)
+				lcKernel<false>(block, i);
+		}
+
+		for (i = 0; i < n; i++) {
+			JP[iFirst + i] = complex<GDouble>(block.JPre[i], block.JPim[i]);
+			JM[iFirst + i] = complex<GDouble>(block.JMre[i], block.JMim[i]);
+		}
+	}
+}
+
+template<int helicityBeam, int helicityElectron> void Clas12PhotonsLeptonicCurrent::calcEvent(GDouble** pKin, complex<GDouble> &JP, complex<GDouble> &J0,
+		complex<GDouble> &JM) {
+
+	const int Ibeam = 0;
+	const int Iscattered = 1;
+	const int Irecoil = 3;
+
+	double JPre, JPim, JMre, JMim;
+
+	J0 = 0;
+	if (helicityBeam != helicityElectron) {
+		JP = 0;
+		JM = 0;
+		return;
+	}
+
+	lcCurrent<double, (helicityBeam == 1)>(pKin[Ibeam][0], pKin[Ibeam][1], pKin[Ibeam][2], pKin[Ibeam][3], pKin[Iscattered][0], pKin[Iscattered][1], pKin[Iscattered][2],
+			pKin[Iscattered][3], pKin[Irecoil][1], pKin[Irecoil][2], pKin[Irecoil][3], JPre, JPim, JMre, JMim);
+
+	JP = complex<GDouble>(JPre, JPim);
+	JM = complex<GDouble>(JMre, JMim);
+}
+
+template void Clas12PhotonsLeptonicCurrent::calcEvent<1, 1>(GDouble**, complex<GDouble>&, complex<GDouble>&, complex<GDouble>&);
+template void Clas12PhotonsLeptonicCurrent::calcEvent<1, -1>(GDouble**, complex<GDouble>&, complex<GDouble>&, complex<GDouble>&);
+template void Clas12PhotonsLeptonicCurrent::calcEvent<-1, 1>(GDouble**, complex<GDouble>&, complex<GDouble>&, complex<GDouble>&);
+template void Clas12PhotonsLeptonicCurrent::calcEvent<-1, -1>(GDouble**, complex<GDouble>&, complex<GDouble>&, complex<GDouble>&);
+
+void Clas12PhotonsLeptonicCurrent::calcEvent(GDouble** pKin, int helicityBeam, int helicityElectron, complex<GDouble> &JP, complex<GDouble> &J0, complex<GDouble> &JM) {
+
+	if ((helicityBeam == 1) && (helicityElectron == 1)) calcEvent<1, 1>(pKin, JP, J0, JM);
+	else if ((helicityBeam == -1) && (helicityElectron == -1)) calcEvent<-1, -1>(pKin, JP, J0, JM);
+	else {
+		JP = 0;
+		J0 = 0;
+		JM = 0;
+	}
+}
+
+void Clas12PhotonsLeptonicCurrent::calcHelicityFrame(GDouble** pKin, GDouble* frame) {
+
+	const int Ibeam = 0;
+	const int Iscattered = 1;
+	const int Irecoil = 3;
+
+	double xx, xy, xz, yx, yy, yz, zx, zy, zz;
+
+	lcFrame<double>(pKin[Ibeam][1] - pKin[Iscattered][1], pKin[Ibeam][2] - pKin[Iscattered][2], pKin[Ibeam][3] - pKin[Iscattered][3], pKin[Irecoil][1], pKin[Irecoil][2],
+			pKin[Irecoil][3], xx, xy, xz, yx, yy, yz, zx, zy, zz);
+
+	frame[0] = xx;
+	frame[1] = xy;
+	frame[2] = xz;
+	frame[3] = yx;
+	frame[4] = yy;
+	frame[5] = yz;
+	frame[6] = zx;
+	frame[7] = zy;
+	frame[8] = zz;
+}
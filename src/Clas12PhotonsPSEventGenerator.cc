@@ -1,4 +1,9 @@
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstdio>
+#include <thread>
 
 #include "IUAmpTools/ConfigurationInfo.h"
 #include "Clas12PhotonsPSEventGenerator.h"
@@ -6,9 +11,10 @@
 #include "TDatabasePDG.h"
 #include "TParticlePDG.h"
 #include "TH1D.h"
+#include "TSystem.h"
 
 Clas12PhotonsPSEventGenerator::Clas12PhotonsPSEventGenerator() :
-		m_dbPDG(0), m_Ebeam(11.), m_Wdistr(0), m_reaction(0), m_seed(0), m_Np(0), m_generatorMaxWt(0) {
+		m_reaction(0), m_dbPDG(0), m_seed(0), m_Ebeam(11.), m_Wdistr(0), m_WdistrEvents(100000), m_WdistrBins(1000), m_WdistrAdaptive(false), m_WdistrGridPoints(0), m_WdistrGridEmin(0), m_WdistrGridEmax(0), m_Np(0), m_generatorMaxWt(0), m_useProposal(false), m_useTsampling(false), m_nThreads(0), m_nextEvent(0) {
 	//init the DB
 	m_dbPDG = TDatabasePDG::Instance();
 	if (m_dbPDG == 0) {
@@ -35,6 +41,7 @@ Clas12PhotonsPSEventGenerator::Clas12PhotonsPSEventGenerator() :
 	m_EprimeMax = 4.5;
 
 	gRandom->SetSeed(m_seed);
+	m_rnd.SetSeed((ULong64_t) m_seed);
 }
 
 void Clas12PhotonsPSEventGenerator::setReaction(ReactionInfo *reaction) {
@@ -84,40 +91,274 @@ void Clas12PhotonsPSEventGenerator::setReaction(ReactionInfo *reaction) {
 }
 
 void Clas12PhotonsPSEventGenerator::computeWdistr() {
-	double Wt, Wval;
-	TLorentzVector Pw;
+	double E1, E2;
+	int i1;
+	Clas12PhotonsCDFSampler sampler1, sampler2;
+	Clas12PhotonsPhaseSpace generator1, generator2;
+
+	if ((m_WdistrCacheDir.size() > 0) && (m_WdistrGridPoints > 1) && (m_Ebeam > m_WdistrGridEmin) && (m_Ebeam < m_WdistrGridEmax)) {
+		//interpolate between the two grid points around the beam energy, unless the energy is cached
+		if (!this->readWdistrCache(m_Ebeam, m_Wsampler, m_generator)) {
+			i1 = (int) ((m_Ebeam - m_WdistrGridEmin) / (m_WdistrGridEmax - m_WdistrGridEmin) * (m_WdistrGridPoints - 1));
+			if (i1 > m_WdistrGridPoints - 2) i1 = m_WdistrGridPoints - 2;
+			E1 = m_WdistrGridEmin + (m_WdistrGridEmax - m_WdistrGridEmin) * i1 / (m_WdistrGridPoints - 1);
+			E2 = m_WdistrGridEmin + (m_WdistrGridEmax - m_WdistrGridEmin) * (i1 + 1) / (m_WdistrGridPoints - 1);
+			Info("computeWdistr", "Interpolating the W distribution between E = %f and E = %f", E1, E2);
+			this->getWdistr(E1, sampler1, generator1);
+			this->getWdistr(E2, sampler2, generator2);
+			this->interpolateWdistr(E1, sampler1, E2, sampler2, m_Ebeam, m_Wsampler);
+			m_generator = generator2; //the max weight only depends on W, the table of E2 covers all the W values at m_Ebeam
+		}
+	} else {
+		this->getWdistr(m_Ebeam, m_Wsampler, m_generator);
+	}
+
+	this->fillWdistrHisto();
+}
 
-	m_generator.SetDecay(m_P0, m_Np, &(m_pmass[0])); //c++ standard guarantees this!
-	m_generatorMaxWt = m_generator.GetWtMax();
+void Clas12PhotonsPSEventGenerator::fillWdistrHisto() {
+	//the monitoring histogram
 	if (m_Wdistr) delete m_Wdistr;
 	m_Wdistr = new TH1D("Wdistr", "Wdistr", 1000, m_Wmin, m_Wmax);
-	Info("computeWdistr", "Start computing the events for the W-distr sampling");
-	for (int ievt = 0; ievt < 100000; ievt++) {
-		Wt = m_generator.Generate();
+	for (int ibin = 1; ibin <= 1000; ibin++)
+		m_Wdistr->SetBinContent(ibin, m_WdistrEvents * (m_Wsampler.CDF(m_Wdistr->GetBinLowEdge(ibin) + m_Wdistr->GetBinWidth(ibin)) - m_Wsampler.CDF(m_Wdistr->GetBinLowEdge(ibin))));
+}
+
+void Clas12PhotonsPSEventGenerator::precomputeWdistrGrid() {
+	Clas12PhotonsCDFSampler sampler;
+	Clas12PhotonsPhaseSpace generator;
+
+	if ((m_WdistrCacheDir.size() == 0) || (m_WdistrGridPoints < 2)) {
+		Error("precomputeWdistrGrid", "The cache directory and the energy grid must be set first");
+		return;
+	}
+	for (int i = 0; i < m_WdistrGridPoints; i++)
+		this->getWdistr(m_WdistrGridEmin + (m_WdistrGridEmax - m_WdistrGridEmin) * i / (m_WdistrGridPoints - 1), sampler, generator);
+}
+
+void Clas12PhotonsPSEventGenerator::getWdistr(double Ebeam, Clas12PhotonsCDFSampler &sampler, Clas12PhotonsPhaseSpace &generator) {
+	if ((m_WdistrCacheDir.size() > 0) && this->readWdistrCache(Ebeam, sampler, generator)) return;
+	this->sampleWdistr(Ebeam, sampler, generator);
+	if (m_WdistrCacheDir.size() > 0) this->writeWdistrCache(Ebeam, sampler, generator);
+}
+
+void Clas12PhotonsPSEventGenerator::sampleWdistr(double Ebeam, Clas12PhotonsCDFSampler &sampler, Clas12PhotonsPhaseSpace &generator) {
+	double Wt, Wval, M0, M, Wmax;
+	Clas12PhotonsFourVector Pw;
+	Clas12PhotonsPhaseSpace fullGenerator;
+	ULong64_t iTry = 0;
+	vector<double> Wvalues;
+
+	M = m_target.M();
+	M0 = sqrt(M * M + 2 * Ebeam * M);
+	Wmax = M0;
+
+	//W is the invariant mass of all the particles but the e', it can be computed in the CM frame
+	fullGenerator.SetMasses(m_Np, &(m_pmass[0])); //c++ standard guarantees this!
+	m_rnd.SetStream(Clas12PhotonsRandom::kMaxWeight, 0);
+	m_rnd.SetEvent(0);
+	fullGenerator.ComputeMaxWeight(&m_rnd, M0, M0, 1);
+	m_generatorMaxWt = fullGenerator.GetMaxWeight(M0);
+	Info("computeWdistr", "Start computing the events for the W-distr sampling, E = %f", Ebeam);
+	m_rnd.SetStream(Clas12PhotonsRandom::kWdistr);
+	Wvalues.reserve(m_WdistrEvents);
+	for (int ievt = 0; ievt < m_WdistrEvents; ievt++) {
+		m_rnd.SetEvent(iTry++);
+		Wt = fullGenerator.GenerateRest(&m_rnd, M0);
 		if (Wt > m_generatorMaxWt) m_generatorMaxWt = Wt; //should not happen
-		if (Wt < gRandom->Uniform(0, m_generatorMaxWt)) {
+		if (Wt < m_rnd.Uniform(0, m_generatorMaxWt)) {
 			ievt--;
 			continue;
 		}
-		Pw.SetXYZT(0, 0, 0, 0);
+		Pw.E = Pw.px = Pw.py = Pw.pz = 0;
 		for (int ip = 1; ip < m_Np; ip++) {
-			Pw += *(m_generator.GetDecay(ip));
+			Pw.E += fullGenerator.GetDecay(ip).E;
+			Pw.px += fullGenerator.GetDecay(ip).px;
+			Pw.py += fullGenerator.GetDecay(ip).py;
+			Pw.pz += fullGenerator.GetDecay(ip).pz;
 		}
-		Wval = Pw.M();
-		m_Wdistr->Fill(Wval);
+		Wval = sqrt(Pw.E * Pw.E - Pw.px * Pw.px - Pw.py * Pw.py - Pw.pz * Pw.pz);
+		Wvalues.push_back(Wval);
 	}
+	sampler.Build(Wvalues, m_Wmin, Wmax, m_WdistrBins, m_WdistrAdaptive);
+
+	//the generator of the W decay, with its max weight for all the W values
+	Info("computeWdistr", "Measuring the max weight of the W decay");
+	generator.SetMasses(m_Np - 1, &(m_pmass[1]));
+	m_rnd.SetStream(Clas12PhotonsRandom::kMaxWeight, 1);
+	m_rnd.SetEvent(0);
+	generator.ComputeMaxWeight(&m_rnd, generator.GetMassSum(), Wmax);
 	Info("computeWdistr", "Done");
 }
 
+void Clas12PhotonsPSEventGenerator::interpolateWdistr(double E1, const Clas12PhotonsCDFSampler &sampler1, double E2, const Clas12PhotonsCDFSampler &sampler2, double Ebeam, Clas12PhotonsCDFSampler &sampler) const {
+	//quantile interpolation in the scaled variable x = (W - Wmin) / (Wmax(E) - Wmin), that goes from 0 to 1 at any energy
+	double M = m_target.M();
+	double Wmax1 = sqrt(M * M + 2 * E1 * M);
+	double Wmax2 = sqrt(M * M + 2 * E2 * M);
+	double Wmax = sqrt(M * M + 2 * Ebeam * M);
+	double f = (Ebeam - E1) / (E2 - E1);
+	int nbins = max(sampler1.GetNbins(), sampler2.GetNbins());
+	double q, x1, x2, W;
+	vector<double> edges, contents;
+
+	edges.push_back(m_Wmin);
+	for (int k = 1; k < nbins; k++) {
+		q = 1. * k / nbins;
+		x1 = (sampler1.Sample(q) - m_Wmin) / (Wmax1 - m_Wmin);
+		x2 = (sampler2.Sample(q) - m_Wmin) / (Wmax2 - m_Wmin);
+		W = m_Wmin + ((1 - f) * x1 + f * x2) * (Wmax - m_Wmin);
+		if (W > edges.back()) {
+			edges.push_back(W);
+			contents.push_back(q);
+		}
+	}
+	edges.push_back(Wmax);
+	contents.push_back(1);
+	//the CDF at the edges, to the bin contents
+	for (int k = contents.size() - 1; k > 0; k--)
+		contents[k] -= contents[k - 1];
+	sampler.SetDistribution(contents.size(), &(edges[0]), &(contents[0]));
+}
+
+string Clas12PhotonsPSEventGenerator::WdistrCacheKey(double Ebeam) const {
+	ostringstream key;
+
+	key << setprecision(9) << "Mtarget " << m_target.M() << " masses";
+	for (int ip = 0; ip < m_Np; ip++)
+		key << " " << m_pmass[ip];
+	key << " Ebeam " << Ebeam << " events " << m_WdistrEvents << " bins " << m_WdistrBins << " adaptive " << m_WdistrAdaptive;
+	return key.str();
+}
+
+string Clas12PhotonsPSEventGenerator::WdistrCacheFile(double Ebeam) const {
+	//64-bit FNV-1a hash of the key, stable across compilers and platforms
+	string key = this->WdistrCacheKey(Ebeam);
+	ULong64_t hash = 14695981039346656037ULL;
+	char name[64];
+
+	for (unsigned int i = 0; i < key.size(); i++) {
+		hash ^= (unsigned char) key[i];
+		hash *= 1099511628211ULL;
+	}
+	sprintf(name, "/Wdistr_%016llx.txt", hash);
+	return m_WdistrCacheDir + name;
+}
+
+bool Clas12PhotonsPSEventGenerator::readWdistr(istream &in, double Ebeam, Clas12PhotonsCDFSampler &sampler, Clas12PhotonsPhaseSpace &generator) const {
+	string key;
+	int nbins, nGrid;
+	double Mmin, step;
+	vector<double> edges, cdf, table;
+
+	getline(in, key);
+	if (key != this->WdistrCacheKey(Ebeam)) {
+		Warning("readWdistr", "The W distribution is not for this reaction and beam energy");
+		return false;
+	}
+	in >> nbins;
+	if (!in.good() || nbins < 1) return false;
+	edges.resize(nbins + 1);
+	cdf.resize(nbins + 1);
+	for (int k = 0; k <= nbins; k++)
+		in >> edges[k] >> cdf[k];
+	in >> nGrid >> Mmin >> step;
+	if (!in.good() || nGrid < 1) return false;
+	table.resize(nGrid);
+	for (int k = 0; k < nGrid; k++)
+		in >> table[k];
+	if (in.fail()) {
+		Warning("readWdistr", "The W distribution is truncated");
+		return false;
+	}
+	in.ignore(1, '\n');
+
+	for (int k = 0; k < nbins; k++)
+		cdf[k] = cdf[k + 1] - cdf[k];
+	sampler.SetDistribution(nbins, &(edges[0]), &(cdf[0]));
+	generator.SetMasses(m_Np - 1, &(m_pmass[1]));
+	generator.SetMaxWeightTable(table, Mmin, step);
+	return true;
+}
+
+void Clas12PhotonsPSEventGenerator::writeWdistr(ostream &out, double Ebeam, const Clas12PhotonsCDFSampler &sampler, const Clas12PhotonsPhaseSpace &generator) const {
+	vector<double> table;
+	double Mmin, step;
+	streamsize precision = out.precision();
+
+	out << this->WdistrCacheKey(Ebeam) << "\n";
+	out << setprecision(17);
+	out << sampler.GetNbins() << "\n";
+	for (int k = 0; k <= sampler.GetNbins(); k++)
+		out << sampler.GetEdges()[k] << " " << sampler.GetCDF()[k] << "\n";
+	generator.GetMaxWeightTable(table, Mmin, step);
+	out << table.size() << " " << Mmin << " " << step << "\n";
+	for (unsigned int k = 0; k < table.size(); k++)
+		out << table[k] << "\n";
+	out.precision(precision);
+}
+
+bool Clas12PhotonsPSEventGenerator::readWdistrCache(double Ebeam, Clas12PhotonsCDFSampler &sampler, Clas12PhotonsPhaseSpace &generator) const {
+	string fname = this->WdistrCacheFile(Ebeam);
+	ifstream file(fname.c_str());
+
+	if (!file.good()) return false;
+	if (!this->readWdistr(file, Ebeam, sampler, generator)) {
+		Warning("readWdistrCache", "File %s ignored", fname.c_str());
+		return false;
+	}
+	Info("readWdistrCache", "W distribution for E = %f read from %s", Ebeam, fname.c_str());
+	return true;
+}
+
+void Clas12PhotonsPSEventGenerator::writeWdistrCache(double Ebeam, const Clas12PhotonsCDFSampler &sampler, const Clas12PhotonsPhaseSpace &generator) const {
+	string fname = this->WdistrCacheFile(Ebeam);
+	ostringstream tmpname;
+
+	//written to a temporary file and then renamed, since several jobs may write the same entry at the same time
+	tmpname << fname << ".tmp" << gSystem->GetPid();
+	ofstream file(tmpname.str().c_str());
+	if (!file.good()) {
+		Warning("writeWdistrCache", "Can't write %s", tmpname.str().c_str());
+		return;
+	}
+	this->writeWdistr(file, Ebeam, sampler, generator);
+	file.close();
+	if (file.fail() || rename(tmpname.str().c_str(), fname.c_str()) != 0) {
+		Warning("writeWdistrCache", "Can't write %s", fname.c_str());
+		remove(tmpname.str().c_str());
+		return;
+	}
+	Info("writeWdistrCache", "W distribution for E = %f written to %s", Ebeam, fname.c_str());
+}
+
+void Clas12PhotonsPSEventGenerator::saveWdistr(ostream &out) {
+	if (m_Wdistr == 0) this->computeWdistr();
+	this->writeWdistr(out, m_Ebeam, m_Wsampler, m_generator);
+}
+
+bool Clas12PhotonsPSEventGenerator::loadWdistr(istream &in) {
+	if (!this->readWdistr(in, m_Ebeam, m_Wsampler, m_generator)) return false;
+	this->fillWdistrHisto();
+	return true;
+}
+
+void Clas12PhotonsPSEventGenerator::fillAmpToolsOrder(const vector<TLorentzVector> &vP, vector<TLorentzVector> &v) const {
+	v.resize(m_Np + 2);
+	v[0] = m_beam;
+	v[1] = vP[0];
+	v[2] = m_target;
+	for (int ip = 1; ip < m_Np; ip++)
+		v[ip + 2] = vP[ip];
+}
+
 void Clas12PhotonsPSEventGenerator::Generate() {
+	this->GenerateEvent(m_nextEvent);
+	m_nextEvent++;
+}
+
+void Clas12PhotonsPSEventGenerator::GenerateEvent(ULong64_t index) {
 
-	TLorentzVector Peprime, Pw;
-	double u, u_min, u_max;
-	double ctheta, ctheta_min, ctheta_max, phi;
-	double M, E0;
-	double Wval, WminGen, WmaxGen;
-	double Eprime;
-	double Wt;
 	if (m_reaction == 0){
 		Error("Generate","Reaction not set yet!");
 		return;
@@ -127,10 +368,146 @@ void Clas12PhotonsPSEventGenerator::Generate() {
 		Info("Generate", "W distribution not yet sampled. Doing so now");
 		this->computeWdistr();
 	}
+
+	GenerateCounters counters;
+	m_rnd.SetStream(Clas12PhotonsRandom::kPhaseSpace);
+	m_rnd.SetEvent(index);
+	this->Generate(&m_rnd, m_generator, m_vP, counters);
+	this->fillAmpToolsOrder(m_vP, m_vPAmpTools);
+	this->reportCounters("GenerateEvent", counters);
+}
+
+void Clas12PhotonsPSEventGenerator::GenerateBlock(vector<vector<TLorentzVector> > &block, vector<double> *jacobian, vector<double> *inputs) {
+	ULong64_t firstEvent = m_nextEvent;
+
+	m_nextEvent += block.size();
+	this->GenerateBlock(block, firstEvent, jacobian, inputs);
+}
+
+void Clas12PhotonsPSEventGenerator::GenerateBlock(vector<vector<TLorentzVector> > &block, ULong64_t firstEvent, vector<double> *jacobian, vector<double> *inputs) {
+	int nThreads, nEvents, nDim;
+	vector<std::thread> threads;
+	ULong64_t seed = (ULong64_t) m_seed;
+
+	if (m_reaction == 0) {
+		Error("GenerateBlock", "Reaction not set yet!");
+		return;
+	}
+
+	if (m_Wdistr == 0) {
+		Info("GenerateBlock", "W distribution not yet sampled. Doing so now");
+		this->computeWdistr();
+	}
+
+	nEvents = block.size();
+	nDim = this->getProposalDim();
+	if (jacobian) jacobian->resize(nEvents);
+	if (inputs) inputs->resize((long) nEvents * nDim);
+	nThreads = m_nThreads;
+	if (nThreads <= 0) nThreads = std::thread::hardware_concurrency();
+	if (nThreads > nEvents) nThreads = nEvents;
+	if (nThreads < 1) nThreads = 1;
+
+	//no ROOT messages from the threads: each one counts in its own slot
+	vector<GenerateCounters> counters(nThreads);
+	for (int ithread = 0; ithread < nThreads; ithread++) {
+		threads.push_back(std::thread([this, &block, seed, firstEvent, jacobian, inputs, nDim](long iFirst, long iLast, GenerateCounters *threadCounters) {
+			Clas12PhotonsRandom rnd(seed, Clas12PhotonsRandom::kPhaseSpace);
+			Clas12PhotonsPhaseSpace generator(m_generator);
+			vector<TLorentzVector> vP;
+			double jac;
+			for (long i = iFirst; i < iLast; i++) {
+				rnd.SetEvent(firstEvent + i);
+				jac = this->Generate(&rnd, generator, vP, *threadCounters, inputs ? &((*inputs)[i * nDim]) : 0);
+				if (jacobian) (*jacobian)[i] = jac;
+				this->fillAmpToolsOrder(vP, block[i]);
+			}
+		}, (long) nEvents * ithread / nThreads, (long) nEvents * (ithread + 1) / nThreads, &(counters[ithread])));
+	}
+	for (int ithread = 0; ithread < nThreads; ithread++)
+		threads[ithread].join();
+
+	for (int ithread = 1; ithread < nThreads; ithread++)
+		counters[0].add(counters[ithread]);
+	this->reportCounters("GenerateBlock", counters[0]);
+}
+
+void Clas12PhotonsPSEventGenerator::GenerateCounters::add(const GenerateCounters &other) {
+	nWmaxClipped += other.nWmaxClipped;
+	nWminClipped += other.nWminClipped;
+	nOverweight += other.nOverweight;
+	if (other.maxOverweight > maxOverweight) maxOverweight = other.maxOverweight;
+}
+
+void Clas12PhotonsPSEventGenerator::reportCounters(const char *method, const GenerateCounters &counters) const {
+	if (counters.nWmaxClipped > 0) Warning(method, "%li events: the max value of W from e' scattering and limits on the energy is above the physical one %f, clipped", counters.nWmaxClipped, m_Wmax);
+	if (counters.nWminClipped > 0) Warning(method, "%li events: the min value of W from e' scattering and limits on the energy is below the physical one %f, clipped", counters.nWminClipped, m_Wmin);
+	if (counters.nOverweight > 0)
+		Warning(method, "%li events with the decay weight above the measured max, up to %f times it: their jacobian carries the excess", counters.nOverweight, counters.maxOverweight);
+}
+
+double Clas12PhotonsPSEventGenerator::sampleT(TRandom *rnd, Clas12PhotonsPhaseSpace &generator, const Clas12PhotonsFourVector &Pw) const {
+	Clas12PhotonsFourVector T;
+	double bx, by, bz, gamma;
+	double Mt, pT, ER, pR, mR2, t, t1, t2, F1, F2, g;
+
+	//the target in the W rest frame
+	bx = Pw.px / Pw.E;
+	by = Pw.py / Pw.E;
+	bz = Pw.pz / Pw.E;
+	gamma = 1 / sqrt(1 - bx * bx - by * by - bz * bz);
+	Mt = m_target.M();
+	T.E = gamma * Mt;
+	T.px = -gamma * bx * Mt;
+	T.py = -gamma * by * Mt;
+	T.pz = -gamma * bz * Mt;
+	pT = sqrt(T.px * T.px + T.py * T.py + T.pz * T.pz);
+
+	//the recoil is the first decay product. t = 2 (ET ER - pT pR cos) - Mt^2 - mR^2
+	const Clas12PhotonsFourVector &R = generator.GetDecay(0);
+	ER = R.E;
+	pR = sqrt(R.px * R.px + R.py * R.py + R.pz * R.pz);
+	mR2 = ER * ER - pR * pR;
+	t1 = 2 * (T.E * ER - pT * pR) - Mt * Mt - mR2;
+	t2 = 2 * (T.E * ER + pT * pR) - Mt * Mt - mR2;
+	if (t2 - t1 <= 0) return 1;
+
+	F1 = m_Tsampler.CDF(t1);
+	F2 = m_Tsampler.CDF(t2);
+	t = m_Tsampler.Sample(rnd->Rndm(), t1, t2);
+	g = m_Tsampler.Density(t);
+	if (F2 <= F1 || g <= 0) return 1; //no probability in the range: t was sampled uniformly
+
+	generator.RotateRest(0, T, (T.E * ER - (t + Mt * Mt + mR2) / 2) / (pT * pR));
+	return (F2 - F1) / ((t2 - t1) * g);
+}
+
+double Clas12PhotonsPSEventGenerator::Generate(TRandom *rnd, Clas12PhotonsPhaseSpace &generator, vector<TLorentzVector> &vP, GenerateCounters &counters, double *x) const {
+
+	TLorentzVector Peprime;
+	Clas12PhotonsFourVector Pw;
+	double u, u_min, u_max;
+	double ctheta, ctheta_min, ctheta_max, phi;
+	double M, E0;
+	double Wval, WminGen, WmaxGen;
+	double Eprime;
+	double Wt, generatorMaxWt;
+	double y[3 + 2 * Clas12PhotonsPhaseSpace::maxParticles], xbuf[3 + 2 * Clas12PhotonsPhaseSpace::maxParticles];
+	double jac = 1;
+	int nDim = this->getProposalDim();
+
 	M = m_target.M();
 	E0 = m_Ebeam;
 
-	m_vP.clear();
+	vP.resize(m_Np);
+
+	//with the proposal grid, all the inputs are drawn first and mapped: x[0] for u, x[1] for W, x[2] for phi, then the decay angles
+	if (x == 0) x = xbuf;
+	if (m_useProposal) {
+		for (int idim = 0; idim < nDim; idim++)
+			y[idim] = rnd->Rndm();
+		jac = m_proposal.Map(y, x);
+	}
 
 	//First part of the computation: pseudo 2-body reaction e p -> e (W), with W all the other particles in final state
 	//See A. Celentano PhD thesis, p.112
@@ -143,7 +520,7 @@ void Clas12PhotonsPSEventGenerator::Generate() {
 	u_min = M / 2 * (ctheta_min + 1) / (M + E0 * (1 - ctheta_min));
 	u_max = M / 2 * (ctheta_max + 1) / (M + E0 * (1 - ctheta_max));
 
-	u = gRandom->Uniform(u_min, u_max);
+	u = u_min + (u_max - u_min) * (m_useProposal ? x[0] : rnd->Rndm());
 
 	ctheta = (2 * u * (E0 + M) - M) / (M + 2 * u * E0);
 
@@ -154,42 +531,50 @@ void Clas12PhotonsPSEventGenerator::Generate() {
 	WminGen = sqrt(M * M + 2 * M * (E0 - m_EprimeMax) - 2 * E0 * m_EprimeMax * (1 - ctheta));
 
 	if (WmaxGen > m_Wmax) {
-		Warning("Generate", "The physical max value of W is: %f, but from e' scattering and limits on the energy the limit is: %f ", m_Wmax, WmaxGen);
+		counters.nWmaxClipped++;
 		WmaxGen = m_Wmax;
 	}
 	if (WminGen < m_Wmin) {
-		Warning("Generate", "The physical min value of W is: %f, but from e' scattering and limits on the energy the limit is: %f ", m_Wmin, WminGen);
+		counters.nWminClipped++;
 		WminGen = m_Wmin;
 	}
 
-	while (1) {
-		Wval = m_Wdistr->GetRandom();
-		if ((Wval > WminGen) && (Wval < WmaxGen)) break;
-	}
+	//sampled directly in [WminGen,WmaxGen], no rejection
+	Wval = m_Wsampler.Sample(m_useProposal ? x[1] : rnd->Rndm(), WminGen, WmaxGen);
 
 	Eprime = (-Wval * Wval + M * M + 2 * M * E0) / (2 * M + 2 * E0 * (1 - ctheta));
 
 	//1-C: fix the kinematics of scattered e' in the LAB frame
-	phi = gRandom->Uniform(0, TMath::TwoPi());
+	phi = TMath::TwoPi() * (m_useProposal ? x[2] : rnd->Rndm());
 	Peprime.SetXYZT(Eprime * sqrt(1 - ctheta * ctheta) * sin(phi), Eprime * sqrt(1 - ctheta * ctheta) * cos(phi), Eprime * ctheta, Eprime);
-	m_vP.push_back(Peprime);
+	vP[0] = Peprime;
 	//1-D: fix the kinematics of the pseudo-particle "W" in the LAB frame: this is simply P0-Peprime
-	Pw=m_P0-Peprime;
+	Pw.E = m_P0.E() - Peprime.E();
+	Pw.px = m_P0.Px() - Peprime.Px();
+	Pw.py = m_P0.Py() - Peprime.Py();
+	Pw.pz = m_P0.Pz() - Peprime.Pz();
 
 
-	//2: now handle the "decay" process W->other final state particles
-	m_generator.SetDecay(Pw, m_Np - 1, &(m_pmass[1]));
-	m_generatorMaxWt = m_generator.GetWtMax()*2; //*2 is temporary
+	//2: now handle the "decay" process W->other final state particles.
+	//The events are generated in the W rest frame, only the accepted one is boosted to the LAB frame
+	generatorMaxWt = generator.GetMaxWeight(Wval);
 
 	while (1) {
-		Wt = m_generator.Generate();
-		if (Wt > gRandom->Uniform(0, m_generatorMaxWt)) {
-			for (int ip = 0; ip < m_Np - 1; ip++) {
-				m_vP.push_back(*(m_generator.GetDecay(ip)));
-			}
+		Wt = generator.GenerateRest(rnd, Wval, m_useProposal ? x + 3 : 0);
+		if (Wt > generatorMaxWt) {
+			//should not happen. The event is accepted with probability 1 instead of Wt / max, so the jacobian gets the missing factor
+			counters.nOverweight++;
+			if (Wt / generatorMaxWt > counters.maxOverweight) counters.maxOverweight = Wt / generatorMaxWt;
+			jac *= Wt / generatorMaxWt;
 			break;
 		}
+		if (Wt > rnd->Uniform(0, generatorMaxWt)) break;
 	}
-
+	if (m_useTsampling) jac *= this->sampleT(rnd, generator, Pw);
+	generator.Boost(Pw);
+	for (int ip = 0; ip < m_Np - 1; ip++) {
+		const Clas12PhotonsFourVector &P = generator.GetDecay(ip);
+		vP[ip + 1].SetPxPyPzE(P.px, P.py, P.pz, P.E);
+	}
+	return jac;
 }
-
@@ -0,0 +1,67 @@
+#include <chrono>
+
+#include "Clas12PhotonsPSPipeline.h"
+
+//spins before sleeping while waiting for the other thread
+static const int nSpins = 1000;
+
+static void wait(int &n) {
+	if (++n < nSpins) std::this_thread::yield();
+	else std::this_thread::sleep_for(std::chrono::microseconds(50));
+}
+
+Clas12PhotonsPSPipeline::Clas12PhotonsPSPipeline(int depth) :
+		m_depth(depth < 0 ? 0 : depth), m_slots(depth < 1 ? 1 : depth), m_head(0), m_tail(0), m_stop(false) {
+}
+
+Clas12PhotonsPSPipeline::~Clas12PhotonsPSPipeline() {
+	this->Stop();
+}
+
+void Clas12PhotonsPSPipeline::Start(const function<void(Clas12PhotonsPSBlock&, long)> &fill) {
+	this->Stop();
+	m_fill = fill;
+	m_head = 0;
+	m_tail = 0;
+	m_stop = false;
+	if (m_depth > 0) m_producer = std::thread(&Clas12PhotonsPSPipeline::produce, this);
+}
+
+void Clas12PhotonsPSPipeline::produce() {
+	long tail, n = m_slots.size();
+	int nWait;
+
+	while (true) {
+		tail = m_tail.load(std::memory_order_relaxed);
+		nWait = 0;
+		while (tail - m_head.load(std::memory_order_acquire) >= n) { //all the slots are full
+			if (m_stop.load(std::memory_order_relaxed)) return;
+			wait(nWait);
+		}
+		if (m_stop.load(std::memory_order_relaxed)) return;
+		m_fill(m_slots[tail % n], tail);
+		m_tail.store(tail + 1, std::memory_order_release);
+	}
+}
+
+Clas12PhotonsPSBlock& Clas12PhotonsPSPipeline::Next() {
+	long head = m_head.load(std::memory_order_relaxed);
+	int nWait = 0;
+
+	if (m_depth == 0) {
+		m_fill(m_slots[0], head);
+		return m_slots[0];
+	}
+	while (m_tail.load(std::memory_order_acquire) == head) //all the slots are empty
+		wait(nWait);
+	return m_slots[head % (long) m_slots.size()];
+}
+
+void Clas12PhotonsPSPipeline::Release() {
+	m_head.store(m_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void Clas12PhotonsPSPipeline::Stop() {
+	m_stop = true;
+	if (m_producer.joinable()) m_producer.join();
+}
@@ -0,0 +1,221 @@
+#include <algorithm>
+#include <cmath>
+
+#include "Clas12PhotonsPhaseSpace.h"
+
+#include "TRandom.h"
+#include "TMath.h"
+#include "TError.h"
+
+//the measured max weight is multiplied by this
+static const double maxWeightSafety = 1.1;
+
+double Clas12PhotonsPhaseSpace::PDK(double a, double b, double c) {
+	//the momentum of the decay products in a two-body decay a -> b c
+	double x = (a - b - c) * (a + b + c) * (a - b + c) * (a + b - c);
+	x = sqrt(x) / (2 * a);
+	return x;
+}
+
+bool Clas12PhotonsPhaseSpace::SetMasses(int nt, const double *mass) {
+	m_Nt = 0;
+	if (nt < 2 || nt > maxParticles) {
+		Error("SetMasses", "Number of decay particles %i out of range", nt);
+		return false;
+	}
+	m_Nt = nt;
+
+	m_massSum = 0;
+	for (int n = 0; n < m_Nt; n++) {
+		m_Mass[n] = mass[n];
+		m_massSum += mass[n];
+	}
+	m_maxWeight.clear();
+	return true;
+}
+
+void Clas12PhotonsPhaseSpace::ComputeMaxWeight(TRandom *rnd, double Mmin, double Mmax, int nGrid, int nSample) {
+	double M, wt, wtMax;
+
+	if (nGrid < 1) nGrid = 1;
+	if (Mmin < m_massSum) Mmin = m_massSum;
+	if (Mmax < Mmin) Mmax = Mmin;
+
+	m_maxWeightMmin = Mmin;
+	m_maxWeightStep = (nGrid > 1) ? (Mmax - Mmin) / (nGrid - 1) : 0;
+	m_maxWeight.assign(nGrid, 0);
+
+	wtMax = 0;
+	for (int k = 0; k < nGrid; k++) {
+		M = Mmin + k * m_maxWeightStep;
+		for (int i = 0; i < nSample; i++) {
+			wt = this->GenerateRest(rnd, M);
+			if (wt > wtMax) wtMax = wt;
+		}
+		m_maxWeight[k] = wtMax * maxWeightSafety; //wtMax is never decreasing along the grid
+	}
+}
+
+double Clas12PhotonsPhaseSpace::GetMaxWeight(double M) const {
+	int k;
+
+	if (m_maxWeight.size() == 0) {
+		Error("GetMaxWeight", "ComputeMaxWeight was not called");
+		return 0;
+	}
+	if (m_maxWeightStep <= 0) return m_maxWeight[0];
+
+	k = (int) ceil((M - m_maxWeightMmin) / m_maxWeightStep);
+	if (k < 0) k = 0;
+	if (k >= (int) m_maxWeight.size()) k = m_maxWeight.size() - 1;
+	return m_maxWeight[k];
+}
+
+double Clas12PhotonsPhaseSpace::GenerateRest(TRandom *rnd, double M, const double *angles) {
+	double rno[maxParticles];
+	double invMas[maxParticles];
+	double pd[maxParticles];
+	double sum, wt, cZ, sZ, angY, cY, sY, beta, gamma, x, y, z, E, teCmTm;
+	int n, i, j;
+
+	teCmTm = M - m_massSum;
+	if (teCmTm <= 0) return 0;
+
+	rno[0] = 0;
+	if (m_Nt > 2) {
+		for (n = 1; n < m_Nt - 1; n++)
+			rno[n] = rnd->Rndm();
+		std::sort(rno + 1, rno + m_Nt - 1);
+	}
+	rno[m_Nt - 1] = 1;
+
+	sum = 0;
+	for (n = 0; n < m_Nt; n++) {
+		sum += m_Mass[n];
+		invMas[n] = rno[n] * teCmTm + sum;
+	}
+
+	//compute the weight of the current event
+	wt = 1;
+	for (n = 0; n < m_Nt - 1; n++) {
+		pd[n] = PDK(invMas[n + 1], invMas[n], m_Mass[n + 1]);
+		wt *= pd[n];
+	}
+
+	//complete specification of the event (Raubold-Lynch method)
+	m_DecPro[0].E = sqrt(pd[0] * pd[0] + m_Mass[0] * m_Mass[0]);
+	m_DecPro[0].px = 0;
+	m_DecPro[0].py = pd[0];
+	m_DecPro[0].pz = 0;
+
+	i = 1;
+	while (1) {
+		m_DecPro[i].E = sqrt(pd[i - 1] * pd[i - 1] + m_Mass[i] * m_Mass[i]);
+		m_DecPro[i].px = 0;
+		m_DecPro[i].py = -pd[i - 1];
+		m_DecPro[i].pz = 0;
+
+		cZ = 2 * (angles ? angles[2 * (i - 1)] : rnd->Rndm()) - 1;
+		sZ = sqrt(1 - cZ * cZ);
+		angY = 2 * TMath::Pi() * (angles ? angles[2 * (i - 1) + 1] : rnd->Rndm());
+		cY = cos(angY);
+		sY = sin(angY);
+		for (j = 0; j <= i; j++) {
+			//rotate around z, then around y
+			x = cZ * m_DecPro[j].px - sZ * m_DecPro[j].py;
+			y = sZ * m_DecPro[j].px + cZ * m_DecPro[j].py;
+			z = m_DecPro[j].pz;
+			m_DecPro[j].px = cY * x - sY * z;
+			m_DecPro[j].py = y;
+			m_DecPro[j].pz = sY * x + cY * z;
+		}
+
+		if (i == (m_Nt - 1)) break;
+
+		//boost along y
+		beta = pd[i] / sqrt(pd[i] * pd[i] + invMas[i] * invMas[i]);
+		gamma = 1 / sqrt(1 - beta * beta);
+		for (j = 0; j <= i; j++) {
+			E = m_DecPro[j].E;
+			y = m_DecPro[j].py;
+			m_DecPro[j].E = gamma * (E + beta * y);
+			m_DecPro[j].py = gamma * (y + beta * E);
+		}
+		i++;
+	}
+
+	return wt;
+}
+
+void Clas12PhotonsPhaseSpace::RotateRest(int n, const Clas12PhotonsFourVector &a, double cosTheta) {
+	double ax, ay, az, nx, ny, nz, kx, ky, kz, k, norm;
+	double angle, c, s, x, y, z, kp;
+
+	//unit vectors along a and along particle n
+	norm = sqrt(a.px * a.px + a.py * a.py + a.pz * a.pz);
+	if (norm <= 0) return;
+	ax = a.px / norm;
+	ay = a.py / norm;
+	az = a.pz / norm;
+	norm = sqrt(m_DecPro[n].px * m_DecPro[n].px + m_DecPro[n].py * m_DecPro[n].py + m_DecPro[n].pz * m_DecPro[n].pz);
+	if (norm <= 0) return;
+	nx = m_DecPro[n].px / norm;
+	ny = m_DecPro[n].py / norm;
+	nz = m_DecPro[n].pz / norm;
+
+	//the rotation axis is a x n, the angle is the change of polar angle
+	kx = ay * nz - az * ny;
+	ky = az * nx - ax * nz;
+	kz = ax * ny - ay * nx;
+	k = sqrt(kx * kx + ky * ky + kz * kz);
+	if (k < 1E-12) { //n along a: any axis orthogonal to a
+		if (fabs(ax) < 0.9) {
+			kx = 0;
+			ky = az;
+			kz = -ay;
+		} else {
+			kx = -az;
+			ky = 0;
+			kz = ax;
+		}
+		k = sqrt(kx * kx + ky * ky + kz * kz);
+	}
+	kx /= k;
+	ky /= k;
+	kz /= k;
+	if (cosTheta > 1) cosTheta = 1;
+	if (cosTheta < -1) cosTheta = -1;
+	angle = acos(cosTheta) - acos(max(-1., min(1., ax * nx + ay * ny + az * nz)));
+	c = cos(angle);
+	s = sin(angle);
+
+	//Rodrigues formula
+	for (int j = 0; j < m_Nt; j++) {
+		x = m_DecPro[j].px;
+		y = m_DecPro[j].py;
+		z = m_DecPro[j].pz;
+		kp = kx * x + ky * y + kz * z;
+		m_DecPro[j].px = x * c + (ky * z - kz * y) * s + kx * kp * (1 - c);
+		m_DecPro[j].py = y * c + (kz * x - kx * z) * s + ky * kp * (1 - c);
+		m_DecPro[j].pz = z * c + (kx * y - ky * x) * s + kz * kp * (1 - c);
+	}
+}
+
+void Clas12PhotonsPhaseSpace::Boost(const Clas12PhotonsFourVector &P) {
+	double bx, by, bz, b2, gamma, gamma2, bp;
+
+	bx = P.px / P.E;
+	by = P.py / P.E;
+	bz = P.pz / P.E;
+	b2 = bx * bx + by * by + bz * bz;
+	gamma = 1 / sqrt(1 - b2);
+	gamma2 = (b2 > 0) ? (gamma - 1) / b2 : 0;
+
+	for (int n = 0; n < m_Nt; n++) {
+		bp = bx * m_DecPro[n].px + by * m_DecPro[n].py + bz * m_DecPro[n].pz;
+		m_DecPro[n].px += gamma2 * bp * bx + gamma * bx * m_DecPro[n].E;
+		m_DecPro[n].py += gamma2 * bp * by + gamma * by * m_DecPro[n].E;
+		m_DecPro[n].pz += gamma2 * bp * bz + gamma * bz * m_DecPro[n].E;
+		m_DecPro[n].E = gamma * (m_DecPro[n].E + bp);
+	}
+}
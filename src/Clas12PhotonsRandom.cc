@@ -0,0 +1,75 @@
+#include "Clas12PhotonsRandom.h"
+
+#include <cfloat>
+#include <algorithm>
+
+//Philox4x32 constants
+static const UInt_t PhiloxM0 = 0xD2511F53;
+static const UInt_t PhiloxM1 = 0xCD9E8D57;
+static const UInt_t PhiloxW0 = 0x9E3779B9;
+static const UInt_t PhiloxW1 = 0xBB67AE85;
+
+Clas12PhotonsRandom::Clas12PhotonsRandom(ULong64_t seed, UInt_t stream) :
+		TRandom(), m_stream(0), m_event(0), m_draw(0), m_nBuffered(0) {
+	m_key[0] = seed & 0xFFFFFFFF;
+	m_key[1] = seed >> 32;
+	this->SetStream(stream);
+}
+
+void Clas12PhotonsRandom::SetSeed(ULong_t seed) {
+	m_key[0] = ((ULong64_t) seed) & 0xFFFFFFFF;
+	m_key[1] = ((ULong64_t) seed) >> 32;
+	m_draw = 0;
+	m_nBuffered = 0;
+}
+
+void Clas12PhotonsRandom::Philox(const UInt_t *counter, const UInt_t *key, UInt_t *out) {
+	UInt_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+	UInt_t k0 = key[0], k1 = key[1];
+	ULong64_t p0, p1;
+
+	for (int round = 0; round < 10; round++) {
+		p0 = (ULong64_t) PhiloxM0 * c0;
+		p1 = (ULong64_t) PhiloxM1 * c2;
+		c0 = (UInt_t) (p1 >> 32) ^ c1 ^ k0;
+		c2 = (UInt_t) (p0 >> 32) ^ c3 ^ k1;
+		c1 = (UInt_t) p1;
+		c3 = (UInt_t) p0;
+		k0 += PhiloxW0;
+		k1 += PhiloxW1;
+	}
+	out[0] = c0;
+	out[1] = c1;
+	out[2] = c2;
+	out[3] = c3;
+}
+
+Double_t Clas12PhotonsRandom::Rndm() {
+	UInt_t counter[4];
+	ULong64_t x;
+
+	if (m_nBuffered == 0) {
+		counter[0] = m_draw++;
+		counter[1] = m_stream;
+		counter[2] = m_event & 0xFFFFFFFF;
+		counter[3] = m_event >> 32;
+		Philox(counter, m_key, m_buffer);
+		m_nBuffered = 2;
+	}
+	m_nBuffered--;
+	//52 bits: (x + 0.5) / 2^52 is exact, from 2^-53 to 1 - 2^-53, never 0 or 1
+	x = (((ULong64_t) m_buffer[2 * m_nBuffered] << 32) | m_buffer[2 * m_nBuffered + 1]) >> 12;
+	return (x + 0.5) * (1. / 4503599627370496.); //2^52
+}
+
+void Clas12PhotonsRandom::RndmArray(Int_t n, Float_t *array) {
+	const Float_t maxFloat = 1 - FLT_EPSILON / 2; //the largest float below 1, closer values would round to 1
+
+	for (int i = 0; i < n; i++)
+		array[i] = std::min((Float_t) this->Rndm(), maxFloat);
+}
+
+void Clas12PhotonsRandom::RndmArray(Int_t n, Double_t *array) {
+	for (int i = 0; i < n; i++)
+		array[i] = this->Rndm();
+}
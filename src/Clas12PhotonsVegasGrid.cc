@@ -0,0 +1,122 @@
+#include <algorithm>
+#include <cmath>
+
+#include "Clas12PhotonsVegasGrid.h"
+
+#include "TError.h"
+
+//every bin keeps at least this fraction of the average importance, so that no region is left without events
+static const double minImportance = 0.01;
+
+void Clas12PhotonsVegasGrid::Init(int ndim, int nbins) {
+	if (ndim < 0) ndim = 0;
+	if (nbins < 1) nbins = 1;
+	m_ndim = ndim;
+	m_nbins = nbins;
+	m_edges.resize(m_ndim * (m_nbins + 1));
+	for (int idim = 0; idim < m_ndim; idim++)
+		for (int i = 0; i <= m_nbins; i++)
+			m_edges[idim * (m_nbins + 1) + i] = 1. * i / m_nbins;
+	m_sum.assign(m_ndim * m_nbins, 0);
+	m_fixed.assign(m_ndim, false);
+}
+
+bool Clas12PhotonsVegasGrid::SetEdges(int ndim, int nbins, const vector<double> &edges) {
+	if (ndim < 0 || nbins < 1 || (int) edges.size() != ndim * (nbins + 1)) {
+		Error("SetEdges", "%i edges for %i dimensions and %i bins", (int) edges.size(), ndim, nbins);
+		return false;
+	}
+	m_ndim = ndim;
+	m_nbins = nbins;
+	m_edges = edges;
+	m_sum.assign(m_ndim * m_nbins, 0);
+	m_fixed.resize(m_ndim, false);
+	return true;
+}
+
+double Clas12PhotonsVegasGrid::Map(const double *y, double *x) const {
+	const double *e;
+	double z, w, jac = 1;
+	int i;
+
+	for (int idim = 0; idim < m_ndim; idim++) {
+		if (m_fixed[idim]) {
+			x[idim] = y[idim];
+			continue;
+		}
+		e = &(m_edges[idim * (m_nbins + 1)]);
+		z = y[idim] * m_nbins;
+		i = (int) z;
+		if (i >= m_nbins) i = m_nbins - 1;
+		w = e[i + 1] - e[i];
+		x[idim] = e[i] + (z - i) * w;
+		jac *= m_nbins * w;
+	}
+	return jac;
+}
+
+void Clas12PhotonsVegasGrid::Accumulate(const double *x, double f) {
+	vector<double>::const_iterator first;
+	int i;
+
+	for (int idim = 0; idim < m_ndim; idim++) {
+		if (m_fixed[idim]) continue;
+		first = m_edges.begin() + idim * (m_nbins + 1);
+		i = upper_bound(first, first + m_nbins + 1, x[idim]) - first - 1;
+		if (i < 0) i = 0;
+		if (i >= m_nbins) i = m_nbins - 1;
+		m_sum[idim * m_nbins + i] += fabs(f);
+	}
+}
+
+void Clas12PhotonsVegasGrid::Adapt() {
+	vector<double> d(m_nbins), r(m_nbins), newEdges(m_nbins + 1);
+	double *e;
+	double sum, rSum, acc, target;
+	int j;
+
+	if (m_nbins == 1) {
+		m_sum.assign(m_ndim * m_nbins, 0);
+		return;
+	}
+	for (int idim = 0; idim < m_ndim; idim++) {
+		if (m_fixed[idim]) continue;
+		e = &(m_edges[idim * (m_nbins + 1)]);
+		const double *s = &(m_sum[idim * m_nbins]);
+
+		//smoothing with the neighbours
+		d[0] = (s[0] + s[1]) / 2;
+		d[m_nbins - 1] = (s[m_nbins - 2] + s[m_nbins - 1]) / 2;
+		for (int i = 1; i < m_nbins - 1; i++)
+			d[i] = (s[i - 1] + s[i] + s[i + 1]) / 3;
+		sum = 0;
+		for (int i = 0; i < m_nbins; i++)
+			sum += d[i];
+		if (sum <= 0) continue;
+
+		//importance of each bin, damped
+		rSum = 0;
+		for (int i = 0; i < m_nbins; i++) {
+			d[i] = max(d[i] / sum, minImportance / m_nbins);
+			r[i] = (d[i] < 1) ? pow((1 - d[i]) / -log(d[i]), m_alpha) : 1;
+			rSum += r[i];
+		}
+
+		//new edges, with the same importance between two of them
+		newEdges[0] = e[0];
+		newEdges[m_nbins] = e[m_nbins];
+		acc = 0;
+		j = 0;
+		for (int k = 1; k < m_nbins; k++) {
+			target = rSum * k / m_nbins;
+			while (j < m_nbins - 1 && acc + r[j] < target) {
+				acc += r[j];
+				j++;
+			}
+			newEdges[k] = e[j] + (e[j + 1] - e[j]) * min((target - acc) / r[j], 1.);
+		}
+		for (int i = 0; i <= m_nbins; i++)
+			e[i] = newEdges[i];
+	}
+	m_sum.assign(m_ndim * m_nbins, 0);
+}